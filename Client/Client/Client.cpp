@@ -1,74 +1,378 @@
 #include <iostream>
 #include <thread>
 #include <string>
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdlib>
+#include "ChatClient.h"
 
-#pragma comment(lib, "ws2_32.lib")
+typedef ChatClient::Clock Clock;
 
-void receiveMessages(SOCKET clientSocket) {
-    char buf[4096];
-    while (true) {
-        ZeroMemory(buf, 4096);
-        int bytesReceived = recv(clientSocket, buf, 4096, 0);
-        if (bytesReceived > 0) {
-            std::cout << std::string(buf, 0, bytesReceived) << std::endl;
-        }
+namespace {
+    const int kPollIntervalMs = 50;     // also bounds the delay before typed lines are sent
+
+    // The server pings a quiet connection every 30 s by default; this much
+    // silence means it or the path to it is gone.
+    const auto kServerSilence = std::chrono::seconds(120);
+
+    // How long a sender's name may be looked up before their messages print
+    // under a placeholder instead.
+    const auto kLookupTimeout = std::chrono::seconds(5);
+
+    // Sequence numbers remembered per room for recognizing repeated frames.
+    const size_t kSeenPerRoom = 256;
+}
+
+void printMessage(std::string_view room, std::string_view text) {
+    if (room.empty()) {
+        std::cout << text << std::endl;
+    } else {
+        std::cout << "[" << room << "] " << text << std::endl;
     }
 }
 
-int main() {
-    // Initialize Winsock
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "Failed to initialize Winsock. Error: " << WSAGetLastError() << std::endl;
-        return 1;
+// Chat frames name their sender by user ID. Names are looked up once per ID
+// and cached; messages from a sender still being looked up are held back,
+// along with everything after them, so they print in order. Lookups are
+// queued on the connection; one unanswered for kLookupTimeout is given up on.
+class ChatPrinter {
+public:
+    explicit ChatPrinter(ChatClient& client) : client(client) {
     }
 
-    // Create a socket
-    SOCKET clientSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (clientSocket == INVALID_SOCKET) {
-        std::cerr << "Socket creation failed. Error: " << WSAGetLastError() << std::endl;
-        WSACleanup();
-        return 1;
+    // A new connection may be to a restarted server that numbers users afresh.
+    void reset() {
+        names.clear();
+        requested.clear();
+        outstanding.clear();
+        pending.clear();
+        lateAnswers = 0;
+    }
+
+    void onWelcome(uint32_t ownId, const std::string& ownName) {
+        names[ownId] = ownName;
+    }
+
+    void onChat(std::string_view room, uint32_t senderId, std::string_view text) {
+        if (pending.empty() && names.count(senderId) != 0) {
+            print(room, senderId, text);
+            return;
+        }
+        pending.push_back({ std::string(room), senderId, std::string(text) });
+        if (names.count(senderId) == 0 && requested.count(senderId) == 0) {
+            requested.insert(senderId);
+            outstanding.push_back({ senderId, Clock::now() });
+            client.lookupUsers(&senderId, 1);
+        }
+    }
+
+    // Each request asks for one ID, so each answer settles the oldest one,
+    // unless that was given up on already.
+    void onUsers(std::string_view payload) {
+        parseUserEntries(payload, [this](uint32_t userId, std::string_view name) {
+            names[userId] = std::string(name);
+        });
+        if (lateAnswers != 0) {
+            --lateAnswers;
+        } else if (!outstanding.empty()) {
+            settle(outstanding.front().userId);
+            outstanding.pop_front();
+        }
+        while (!outstanding.empty() && names.count(outstanding.front().userId) != 0) {
+            outstanding.pop_front();
+        }
+        printReady();
+    }
+
+    // Settles lookups the server has not answered in time, with placeholder
+    // names, so their messages are not held back forever.
+    void expireLookups(Clock::time_point now) {
+        if (outstanding.empty() || now - outstanding.front().sentAt < kLookupTimeout) {
+            return;
+        }
+        while (!outstanding.empty() && now - outstanding.front().sentAt >= kLookupTimeout) {
+            settle(outstanding.front().userId);
+            outstanding.pop_front();
+            ++lateAnswers;
+        }
+        printReady();
+    }
+
+private:
+    struct Pending {
+        std::string room;
+        uint32_t senderId;
+        std::string text;
+    };
+
+    struct Lookup {
+        uint32_t userId;
+        Clock::time_point sentAt;
+    };
+
+    void settle(uint32_t userId) {
+        if (names.count(userId) == 0) {
+            names[userId] = "user #" + std::to_string(userId);
+        }
+    }
+
+    void printReady() {
+        while (!pending.empty() && names.count(pending.front().senderId) != 0) {
+            const Pending& message = pending.front();
+            print(message.room, message.senderId, message.text);
+            pending.pop_front();
+        }
+    }
+
+    void print(std::string_view room, uint32_t senderId, std::string_view text) {
+        printMessage(room, names[senderId] + ": " + std::string(text));
+    }
+
+    ChatClient& client;
+    std::unordered_map<uint32_t, std::string> names;
+    std::unordered_set<uint32_t> requested;
+    std::deque<Lookup> outstanding;
+    size_t lateAnswers = 0;     // answers still due for lookups given up on
+    std::deque<Pending> pending;
+};
+
+// Room frames carry their room's sequence number. The highest seen in each
+// room is where a rejoin after a reconnect resumes from, and a number seen
+// recently marks a repeat: the history replayed on joining a room can
+// overlap frames that also arrive live.
+class SeenFrames {
+public:
+    // False if the frame was already seen. Unnumbered frames are always new.
+    bool fresh(std::string_view room, uint64_t sequence) {
+        if (sequence == 0) {
+            return true;
+        }
+        std::set<uint64_t>& recent = rooms[std::string(room)];
+        if (recent.size() == kSeenPerRoom && sequence < *recent.begin()) {
+            return false;   // older than anything remembered; assume it was shown
+        }
+        if (!recent.insert(sequence).second) {
+            return false;
+        }
+        if (recent.size() > kSeenPerRoom) {
+            recent.erase(recent.begin());
+        }
+        return true;
+    }
+
+    // The highest sequence number seen in the room, or 0.
+    uint64_t last(const std::string& room) const {
+        auto it = rooms.find(room);
+        return it != rooms.end() && !it->second.empty() ? *it->second.rbegin() : 0;
+    }
+
+private:
+    std::unordered_map<std::string, std::set<uint64_t>> rooms;
+};
+
+// The client's connection to the server, run on its own thread as a
+// non-blocking poll loop. When the connection drops or the server goes
+// silent it reconnects with jittered exponential backoff, introduces itself
+// again and rejoins its rooms. Lines typed meanwhile are sent once it is back.
+class ChatSession {
+public:
+    ChatSession(std::string host, uint16_t port, std::string name)
+        : host(std::move(host)), port(port), name(std::move(name)), printer(client) {
+        client.setHandler([this](const Frame& frame) { handleFrame(frame); });
+    }
+
+    // Console thread: queues a line of user input.
+    void submit(std::string line) {
+        std::lock_guard<std::mutex> guard(mutex);
+        input.push_back(std::move(line));
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+    }
+
+    void run() {
+        while (!stopRequested()) {
+            if (serve()) {
+                backoff.reset();
+            }
+            if (stopRequested()) {
+                break;
+            }
+            auto delay = backoff.next();
+            std::cout << "Not connected to " << host << ":" << port << "; retrying in "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(delay).count() << " ms." << std::endl;
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, delay, [this]() { return stopping; });
+        }
+    }
+
+private:
+    bool stopRequested() {
+        std::lock_guard<std::mutex> guard(mutex);
+        return stopping;
     }
 
-    // Setup server address structure
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(54000);
-    inet_pton(AF_INET, "127.0.0.1", &serverAddr.sin_addr);  // Connect to localhost
+    // One connection, from connect to disconnect. True if the server
+    // welcomed us, i.e. the connection worked for a while.
+    bool serve() {
+        if (!client.connect(host.c_str(), port)) {
+            return false;
+        }
+
+        printer.reset();
+        welcomed = false;
 
-    // Connect to the server
-    if (connect(clientSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        std::cerr << "Connection to server failed. Error: " << WSAGetLastError() << std::endl;
-        closesocket(clientSocket);
-        WSACleanup();
+        // The server puts every client in the lobby; restore the rooms we
+        // were in, asking only for what was said since we left
+        client.hello(name);
+        for (const std::string& room : rooms) {
+            if (room == kLobbyRoom) {
+                continue;
+            }
+            if (uint64_t last = seen.last(room)) {
+                client.rejoin(room, last);
+            } else {
+                client.join(room);
+            }
+        }
+        if (rooms.count(kLobbyRoom) == 0) {
+            client.leave(kLobbyRoom);
+        }
+
+        while (true) {
+            // Lines typed before a stop still go out
+            bool stopped = stopRequested();
+            takeInput();
+            if (!client.flush() || stopped || !client.poll(kPollIntervalMs)) {
+                break;
+            }
+            printer.expireLookups(Clock::now());
+            if (Clock::now() - client.lastHeard() > kServerSilence) {
+                std::cout << "The server stopped answering." << std::endl;
+                break;
+            }
+        }
+        if (!stopRequested()) {
+            std::cout << "Disconnected from the server." << std::endl;
+        }
+        client.close();
+        return welcomed;
+    }
+
+    void handleFrame(const Frame& frame) {
+        std::string_view room, text;
+        uint64_t sequence;
+        uint32_t userId;
+        switch (frame.type) {
+        case FrameType::Welcome:
+            if (frame.payload.size() == kUserIdSize) {
+                welcomed = true;
+                printer.onWelcome(getUint32(frame.payload.data()), name);
+            }
+            break;
+        case FrameType::Users:
+            printer.onUsers(frame.payload);
+            break;
+        case FrameType::Chat:
+            if (splitChatPayload(frame.payload, room, sequence, userId, text) && seen.fresh(room, sequence)) {
+                printer.onChat(room, userId, text);
+            }
+            break;
+        default:
+            if (splitSequencedPayload(frame.payload, room, sequence, text) && seen.fresh(room, sequence)) {
+                printMessage(room, text);
+            }
+            break;
+        }
+    }
+
+    // "/join room" joins a room and makes it the one messages go to,
+    // "/leave room" leaves it again.
+    void takeInput() {
+        std::deque<std::string> lines;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            lines.swap(input);
+        }
+        for (const std::string& line : lines) {
+            if (line.rfind("/join ", 0) == 0) {
+                std::string room = line.substr(6);
+                if (!validRoomName(room)) {
+                    std::cout << "Room names are 1 to " << kMaxRoomName << " characters long." << std::endl;
+                    continue;
+                }
+                currentRoom = room;
+                rooms.insert(currentRoom);
+                client.join(currentRoom);
+            } else if (line.rfind("/leave ", 0) == 0) {
+                std::string room = line.substr(7);
+                if (room == currentRoom) {
+                    currentRoom = kLobbyRoom;
+                }
+                rooms.erase(room);
+                client.leave(room);
+            } else if (!line.empty()) {
+                client.chat(currentRoom, line);
+            }
+        }
+    }
+
+    std::string host;
+    uint16_t port;
+    std::string name;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::string> input;      // guarded by mutex
+    bool stopping = false;              // guarded by mutex
+
+    // Session thread only
+    ChatClient client;
+    ChatPrinter printer;
+    SeenFrames seen;
+    bool welcomed = false;
+    std::string currentRoom = kLobbyRoom;
+    std::set<std::string> rooms = { kLobbyRoom };
+    ReconnectBackoff backoff;
+};
+
+// Usage: Client [HOST [PORT]], connecting to 127.0.0.1:54000 by default.
+int main(int argc, char** argv) {
+    const char* host = argc > 1 ? argv[1] : "127.0.0.1";
+    uint16_t port = argc > 2 ? (uint16_t)std::atoi(argv[2]) : 54000;
+
+    // Initialize Winsock
+    if (!netStartup()) {
+        std::cerr << "Failed to initialize Winsock. Error: " << lastSocketError() << std::endl;
         return 1;
     }
 
-    // Get the client's name and send it to the server
     std::string clientName;
     std::cout << "Enter your name: ";
     std::getline(std::cin, clientName);
-    send(clientSocket, clientName.c_str(), clientName.size() + 1, 0);
 
-    // Start a thread to receive messages from the server
-    std::thread recvThread(receiveMessages, clientSocket);
-    recvThread.detach();
+    // The session owns the connection; this thread only reads the console
+    ChatSession session(host, port, clientName);
+    std::thread sessionThread(&ChatSession::run, &session);
 
-    // Main thread will handle sending messages
     std::string userInput;
-    while (true) {
-        std::getline(std::cin, userInput);
-
-        if (userInput.size() > 0) {
-            send(clientSocket, userInput.c_str(), userInput.size() + 1, 0);
-        }
+    while (std::getline(std::cin, userInput)) {
+        session.submit(userInput);
     }
 
     // Cleanup
-    closesocket(clientSocket);
-    WSACleanup();
+    session.stop();
+    sessionThread.join();
+    netCleanup();
     return 0;
 }
@@ -0,0 +1,171 @@
+#include "ChatClient.h"
+
+#include <algorithm>
+
+namespace {
+    // Drained output is compacted once this much of the buffer has been sent.
+    const size_t kCompactThreshold = 64 * 1024;
+}
+
+ChatClient::ChatClient(FrameHandler handler) : handler(std::move(handler)) {
+}
+
+ChatClient::~ChatClient() {
+    close();
+}
+
+bool ChatClient::connect(const char* host, uint16_t port, int timeoutMs) {
+    close();
+    sock = connectSocket(host, port, timeoutMs);
+    if (sock == INVALID_SOCKET) {
+        return false;
+    }
+    if (timeoutMs < 0) {
+        setNonBlocking(sock);
+    }
+
+    // Chat frames are small and latency-bound; don't let Nagle hold them back
+    int noDelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+    parser = FrameParser();
+    output.clear();
+    outputSent = 0;
+    heard = Clock::now();
+    received = 0;
+    return true;
+}
+
+void ChatClient::close() {
+    if (sock != INVALID_SOCKET) {
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+}
+
+char* ChatClient::appendHeader(FrameType type, size_t payloadLength) {
+    size_t start = output.size();
+    output.resize(start + kFrameHeaderSize + payloadLength);
+    writeFrameHeader(&output[start], type, (uint32_t)payloadLength);
+    return &output[start + kFrameHeaderSize];
+}
+
+void ChatClient::hello(std::string_view name) {
+    send(FrameType::Hello, name);
+}
+
+void ChatClient::join(std::string_view room) {
+    send(FrameType::JoinRoom, room);
+}
+
+bool ChatClient::rejoin(std::string_view room, uint64_t lastSequence) {
+    if (!validRoomName(room)) {
+        return false;
+    }
+    char* payload = appendHeader(FrameType::RejoinRoom, kSequenceSize + room.size());
+    putUint64(payload, lastSequence);
+    std::memcpy(payload + kSequenceSize, room.data(), room.size());
+    return true;
+}
+
+void ChatClient::leave(std::string_view room) {
+    send(FrameType::LeaveRoom, room);
+}
+
+// The name's length goes in one byte, so an over-long one would corrupt the
+// frame rather than just be refused.
+bool ChatClient::chat(std::string_view room, std::string_view text) {
+    if (!validRoomName(room)) {
+        return false;
+    }
+    char* payload = appendHeader(FrameType::Chat, 1 + room.size() + text.size());
+    payload[0] = (char)room.size();
+    std::memcpy(payload + 1, room.data(), room.size());
+    std::memcpy(payload + 1 + room.size(), text.data(), text.size());
+    return true;
+}
+
+void ChatClient::lookupUsers(const uint32_t* userIds, size_t count) {
+    char* payload = appendHeader(FrameType::Users, count * kUserIdSize);
+    for (size_t i = 0; i < count; ++i) {
+        putUint32(payload + i * kUserIdSize, userIds[i]);
+    }
+}
+
+void ChatClient::send(FrameType type, std::string_view payload) {
+    std::memcpy(appendHeader(type, payload.size()), payload.data(), payload.size());
+}
+
+bool ChatClient::flush() {
+    if (sock == INVALID_SOCKET) {
+        return false;
+    }
+    while (outputSent < output.size()) {
+        int sent = ::send(sock, output.data() + outputSent, (int)(output.size() - outputSent), MSG_NOSIGNAL);
+        if (sent == SOCKET_ERROR) {
+            if (!isWouldBlock(lastSocketError())) {
+                return false;
+            }
+            break;
+        }
+        outputSent += sent;
+    }
+    if (outputSent == output.size()) {
+        output.clear();
+        outputSent = 0;
+    } else if (outputSent >= kCompactThreshold) {
+        output.erase(0, outputSent);
+        outputSent = 0;
+    }
+    return true;
+}
+
+bool ChatClient::onReadable() {
+    if (sock == INVALID_SOCKET) {
+        return false;
+    }
+    static thread_local char buf[64 * 1024];
+    while (true) {
+        int bytesReceived = recv(sock, buf, sizeof(buf), 0);
+        if (bytesReceived <= 0) {
+            return bytesReceived == SOCKET_ERROR && isWouldBlock(lastSocketError());
+        }
+        heard = Clock::now();
+        received += bytesReceived;
+        bool intact = parser.parse(buf, bytesReceived, [this](const Frame& frame) {
+            if (frame.type == FrameType::Ping) {
+                send(FrameType::Pong, "");
+            } else if (handler) {
+                handler(frame);
+            }
+        });
+        if (!intact) {
+            return false;
+        }
+        if ((size_t)bytesReceived < sizeof(buf)) {
+            // A short read drained the socket; skip the recv() that would block
+            return true;
+        }
+    }
+}
+
+bool ChatClient::poll(int timeoutMs) {
+    if (!flush()) {
+        return false;
+    }
+    pollfd fd = { sock, (short)(POLLIN | (wantsWrite() ? POLLOUT : 0)), 0 };
+    if (pollSockets(&fd, 1, timeoutMs) <= 0) {
+        return true;
+    }
+    if ((fd.revents & (POLLIN | POLLHUP | POLLERR)) && !onReadable()) {
+        return false;
+    }
+    return flush();
+}
+
+ReconnectBackoff::Clock::duration ReconnectBackoff::next() {
+    auto ceiling = std::min<Clock::duration>(kMax, kBase * (1 << std::min(failures, 6)));
+    ++failures;
+    std::uniform_int_distribution<Clock::rep> pick(ceiling.count() / 2, ceiling.count());
+    return Clock::duration(pick(random));
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include "Net.h"
+#include "Protocol.h"
+
+// Client side of the chat protocol over one TCP connection, shared by the
+// console client, the load generator and bots.
+//
+// The connection is non-blocking and the client owns no thread. Callers that
+// multiplex many connections put socket() in their own poll set and call
+// onReadable() and flush() as it reports them ready; single connections can
+// let poll() wait instead. Sends are encoded straight into one output buffer,
+// so every frame queued between two flushes leaves in a single send().
+// Received frames are handed to the handler as views into the receive buffer
+// (see FrameParser); Pings are answered here and never reach it.
+class ChatClient {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Frame payloads are only valid during the call.
+    typedef std::function<void(const Frame&)> FrameHandler;
+
+    static const int kDefaultConnectTimeoutMs = 5000;
+
+    explicit ChatClient(FrameHandler handler = nullptr);
+    ~ChatClient();
+
+    ChatClient(const ChatClient&) = delete;
+    ChatClient& operator=(const ChatClient&) = delete;
+
+    void setHandler(FrameHandler handler) { this->handler = std::move(handler); }
+
+    // Closes any current connection and opens a new one. Frames queued before
+    // the call are discarded.
+    bool connect(const char* host, uint16_t port, int timeoutMs = kDefaultConnectTimeoutMs);
+    void close();
+    bool connected() const { return sock != INVALID_SOCKET; }
+    SOCKET socket() const { return sock; }
+
+    // Queue one frame each; nothing is sent until the next flush(). rejoin()
+    // and chat() queue nothing and return false for a room name the server
+    // would refuse (see validRoomName()).
+    void hello(std::string_view name);
+    void join(std::string_view room);
+    // Joins a room again after a reconnect, caught up only on the frames
+    // after the last sequence number seen in it.
+    bool rejoin(std::string_view room, uint64_t lastSequence);
+    void leave(std::string_view room);
+    bool chat(std::string_view room, std::string_view text);
+    void lookupUsers(const uint32_t* userIds, size_t count);
+    void send(FrameType type, std::string_view payload);
+
+    // Sends as much queued output as the socket takes. False if the
+    // connection failed; the caller should close() it.
+    bool flush();
+    bool wantsWrite() const { return output.size() > outputSent; }
+
+    // Reads until the socket would block and dispatches every complete
+    // frame. False once the server closed the connection, the socket failed
+    // or the stream turned out to be corrupt.
+    bool onReadable();
+
+    // Flushes, then waits up to timeoutMs for the socket and services it.
+    // False once the connection is gone.
+    bool poll(int timeoutMs);
+
+    // When bytes last arrived, for spotting a server that went silent.
+    Clock::time_point lastHeard() const { return heard; }
+    uint64_t bytesReceived() const { return received; }
+
+private:
+    char* appendHeader(FrameType type, size_t payloadLength);
+
+    FrameHandler handler;
+    SOCKET sock = INVALID_SOCKET;
+    FrameParser parser;
+    std::string output;
+    size_t outputSent = 0;  // bytes at the front of output already sent
+    Clock::time_point heard;
+    uint64_t received = 0;
+};
+
+// Reconnect delays for clients that hold a connection open: they double from
+// kBase up to kMax, and each is drawn at random from its upper half, so
+// clients dropped together by a server restart don't all come back in the
+// same instant.
+class ReconnectBackoff {
+public:
+    typedef ChatClient::Clock Clock;
+
+    static constexpr std::chrono::milliseconds kBase{ 500 };
+    static constexpr std::chrono::milliseconds kMax{ 30000 };
+
+    ReconnectBackoff() : random(std::random_device()()) {
+    }
+
+    // The delay before the next attempt.
+    Clock::duration next();
+
+    // After a connection that worked, start over from kBase.
+    void reset() { failures = 0; }
+
+private:
+    int failures = 0;
+    std::mt19937 random;
+};
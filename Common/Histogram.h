@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Log-linear (HDR-style) histogram shared by the server's metrics and the
+// load generator: values below kSubBuckets are exact, and every power-of-two
+// range above is split into kSubBuckets buckets, giving about 1.6% relative
+// precision across the whole range without storing every sample. The unit is
+// the caller's.
+class Histogram {
+public:
+    static const int kSubBuckets = 64;
+    static const int kGroups = 48;
+    static const size_t kBucketCount = (size_t)kGroups * kSubBuckets;
+
+    static size_t indexOf(uint64_t value) {
+        if (value < kSubBuckets) {
+            return (size_t)value;
+        }
+        int group = 0;
+        while ((value >> group) >= 2 * kSubBuckets) {
+            ++group;
+        }
+        size_t index = (size_t)(group + 1) * kSubBuckets + (size_t)((value >> group) - kSubBuckets);
+        return std::min(index, kBucketCount - 1);
+    }
+
+    // Upper bound of the values that map to the bucket.
+    static uint64_t valueOf(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        int group = (int)(index / kSubBuckets) - 1;
+        uint64_t sub = index % kSubBuckets + kSubBuckets;
+        return ((sub + 1) << group) - 1;
+    }
+
+    void record(uint64_t value) {
+        add(indexOf(value), 1);
+        addSum(value);
+        addMax(value);
+    }
+
+    // For callers that keep their own bucket counts and fold them in.
+    void add(size_t index, uint64_t count) { counts[index] += count; total += count; }
+    void addSum(uint64_t value) { sum += value; }
+    void addMax(uint64_t value) { maxValue = std::max(maxValue, value); }
+
+    void merge(const Histogram& other) {
+        for (size_t i = 0; i < kBucketCount; ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    // Value at or below which a fraction p (0..1) of the records fall.
+    uint64_t percentile(double p) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(p * (double)(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBucketCount; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(valueOf(i), maxValue);
+            }
+        }
+        return maxValue;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+    uint64_t sumOfValues() const { return sum; }
+
+private:
+    std::vector<uint64_t> counts = std::vector<uint64_t>(kBucketCount);
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t maxValue = 0;
+};
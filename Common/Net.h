@@ -0,0 +1,181 @@
+#pragma once
+
+// Minimal portability layer so the same socket code builds against Winsock
+// and POSIX sockets. Winsock names (SOCKET, INVALID_SOCKET, closesocket...)
+// are kept as the common vocabulary.
+
+#include <cstdint>
+#include <cstdio>
+
+#ifdef _WIN32
+// Before any Windows header, so every build (CMake or the Visual Studio
+// projects) gets them: the min/max macros would break std::min/std::max.
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+// Winsock never raises SIGPIPE, so the POSIX flag is a no-op here.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define SD_BOTH SHUT_RDWR
+
+inline int closesocket(SOCKET s) { return close(s); }
+#endif
+
+// Returns the error code of the last failed socket call on this thread.
+inline int lastSocketError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+// True when a non-blocking call failed only because it would have blocked.
+inline bool isWouldBlock(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK;
+#else
+    return error == EAGAIN || error == EWOULDBLOCK;
+#endif
+}
+
+inline bool setNonBlocking(SOCKET s) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags != -1 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// poll() over a set of sockets; struct pollfd is available on both platforms.
+inline int pollSockets(pollfd* fds, size_t count, int timeoutMs) {
+#ifdef _WIN32
+    return WSAPoll(fds, (ULONG)count, timeoutMs);
+#else
+    return poll(fds, (nfds_t)count, timeoutMs);
+#endif
+}
+
+// One piece of a gathered send: WSABUF on Windows, iovec elsewhere.
+#ifdef _WIN32
+typedef WSABUF IoBuffer;
+inline void setIoBuffer(IoBuffer& buffer, const char* data, size_t length) {
+    buffer.buf = const_cast<char*>(data);
+    buffer.len = (ULONG)length;
+}
+#else
+typedef iovec IoBuffer;
+inline void setIoBuffer(IoBuffer& buffer, const char* data, size_t length) {
+    buffer.iov_base = const_cast<char*>(data);
+    buffer.iov_len = length;
+}
+#endif
+
+// Sends the buffers back to back with a single call (WSASend / sendmsg).
+// Returns the number of bytes sent, or SOCKET_ERROR.
+inline int sendBuffers(SOCKET s, IoBuffer* buffers, size_t count) {
+#ifdef _WIN32
+    DWORD sent = 0;
+    if (WSASend(s, buffers, (DWORD)count, &sent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+    return (int)sent;
+#else
+    msghdr msg = {};
+    msg.msg_iov = buffers;
+    msg.msg_iovlen = count;
+    return (int)sendmsg(s, &msg, MSG_NOSIGNAL);
+#endif
+}
+
+// True when a non-blocking connect() failed only because it is under way.
+inline bool isConnectInProgress(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK;
+#else
+    return error == EINPROGRESS;
+#endif
+}
+
+// Resolves host and opens a TCP connection to it, trying each address in
+// turn. With a timeout, each attempt waits at most timeoutMs and the socket
+// is returned non-blocking; without, connect() blocks for as long as the OS
+// lets it. Returns INVALID_SOCKET if no address accepts.
+inline SOCKET connectSocket(const char* host, uint16_t port, int timeoutMs = -1) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", (unsigned)port);
+    if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+        return INVALID_SOCKET;
+    }
+    SOCKET s = INVALID_SOCKET;
+    for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+        s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (s == INVALID_SOCKET) {
+            continue;
+        }
+        if (timeoutMs < 0 || setNonBlocking(s)) {
+            if (connect(s, address->ai_addr, (int)address->ai_addrlen) != SOCKET_ERROR) {
+                break;
+            }
+            if (timeoutMs >= 0 && isConnectInProgress(lastSocketError())) {
+                pollfd pending = { s, POLLOUT, 0 };
+                int error = 0;
+                socklen_t errorSize = sizeof(error);
+                if (pollSockets(&pending, 1, timeoutMs) == 1
+                    && getsockopt(s, SOL_SOCKET, SO_ERROR, (char*)&error, &errorSize) == 0 && error == 0) {
+                    break;
+                }
+            }
+        }
+        closesocket(s);
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(addresses);
+    return s;
+}
+
+inline bool netStartup() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    return true;
+#endif
+}
+
+inline void netCleanup() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
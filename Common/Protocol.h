@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Wire format shared by the server and its clients. Every frame is a fixed
+// 8-byte header followed by the payload:
+//
+//   offset 0  uint32  payload length (big-endian)
+//   offset 4  uint8   protocol version
+//   offset 5  uint8   frame type (FrameType)
+//   offset 6  uint16  reserved, must be zero
+//
+// Frames are self-delimiting, so any number of them may arrive in one recv()
+// and a frame may be split across several.
+//
+// Chat and Notice payloads are scoped to a room and start with a room tag:
+// one length byte followed by that many bytes of room name. Every client is
+// placed in kLobbyRoom after its Hello. A Notice with an empty tag is
+// addressed to the client itself rather than to a room.
+//
+// In the frames a server sends, the tag is followed by a uint64 sequence
+// number. Each room numbers its broadcasts in the order it accepts them and
+// every member receives them in that order, so a client can spot a gap, skip
+// a frame it already has, and name the last frame it saw when it rejoins
+// (RejoinRoom) to be sent only what it missed. Numbers only ever grow, across
+// a room being dropped and recreated and across server restarts, but are not
+// consecutive across those. Notices to the client itself carry 0.
+//
+// Senders are identified by compact user IDs rather than names: the server
+// assigns each name an ID (Welcome tells the client its own), chat frames it
+// sends carry only the ID, and clients resolve unknown IDs once with a Users
+// request. An ID's name never changes, so answers can be cached for good.
+//
+// Federated server nodes forward room broadcasts over relay links. A link
+// opens with RelayHello and then carries Chat and Notice frames exactly as
+// clients receive them, each Chat preceded the first time by a Users frame
+// naming its sender. The receiving node renumbers them in its own rooms.
+//
+// A server pings a connection that has been silent for a while and closes
+// one that stays silent; clients answer Ping with Pong. A peer that prefers
+// to keep its connection alive on its own schedule may send Pong unprompted.
+
+const uint8_t kProtocolVersion = 2;
+const size_t kFrameHeaderSize = 8;
+const uint32_t kMaxFramePayload = 64 * 1024;
+const size_t kMaxRoomName = 64;
+const size_t kMaxUserName = 64;
+const size_t kUserIdSize = 4;
+const size_t kSequenceSize = 8;
+const size_t kMaxUserLookup = 1024;    // IDs answered per Users request
+const char* const kLobbyRoom = "lobby";
+
+// The sequence number of a room frame not yet published, and of notices
+// addressed to the client itself.
+const std::string_view kNoSequence("\0\0\0\0\0\0\0\0", kSequenceSize);
+
+enum class FrameType : uint8_t {
+    Hello = 1,      // client -> server: payload is the user's name
+    Chat = 2,       // client -> server: room tag + text
+                    // server -> client: room tag + uint64 sequence + the sender's uint32 user ID + text
+    Notice = 3,     // server -> client: room tag + uint64 sequence + join/leave or other server text
+    JoinRoom = 4,   // client -> server: payload is the room name
+    LeaveRoom = 5,  // client -> server: payload is the room name
+    Welcome = 6,    // server -> client: payload is the client's own uint32 user ID
+    Users = 7,      // client -> server: uint32 user IDs to resolve
+                    // server -> client: entries of uint32 ID + uint8 name length + name
+    RelayHello = 8, // node -> node: the sending node's uint32 node ID, first on a relay link
+    Ping = 9,       // server -> client: empty; answer with Pong
+    Pong = 10,      // client/node -> server: empty; proof of life
+    RejoinRoom = 11, // client -> server: uint64 last sequence seen + room name; joins, catching up only on newer frames
+};
+
+struct Frame {
+    uint8_t version;
+    FrameType type;
+    std::string_view payload;
+};
+
+inline void putUint16(char* out, uint16_t value) {
+    out[0] = (char)(value >> 8);
+    out[1] = (char)value;
+}
+
+inline void putUint32(char* out, uint32_t value) {
+    out[0] = (char)(value >> 24);
+    out[1] = (char)(value >> 16);
+    out[2] = (char)(value >> 8);
+    out[3] = (char)value;
+}
+
+inline void putUint64(char* out, uint64_t value) {
+    putUint32(out, (uint32_t)(value >> 32));
+    putUint32(out + 4, (uint32_t)value);
+}
+
+inline uint16_t getUint16(const char* in) {
+    const unsigned char* p = (const unsigned char*)in;
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+inline uint32_t getUint32(const char* in) {
+    const unsigned char* p = (const unsigned char*)in;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+inline uint64_t getUint64(const char* in) {
+    return ((uint64_t)getUint32(in) << 32) | getUint32(in + 4);
+}
+
+inline void writeFrameHeader(char* out, FrameType type, uint32_t payloadLength) {
+    putUint32(out, payloadLength);
+    out[4] = (char)kProtocolVersion;
+    out[5] = (char)type;
+    putUint16(out + 6, 0);
+}
+
+inline std::string encodeFrame(FrameType type, std::string_view payload) {
+    std::string frame(kFrameHeaderSize + payload.size(), '\0');
+    writeFrameHeader(&frame[0], type, (uint32_t)payload.size());
+    std::memcpy(&frame[kFrameHeaderSize], payload.data(), payload.size());
+    return frame;
+}
+
+inline bool validRoomName(std::string_view room) {
+    return !room.empty() && room.size() <= kMaxRoomName;
+}
+
+// The tag that prefixes room-scoped payloads.
+inline std::string roomTag(std::string_view room) {
+    std::string tag(1, (char)room.size());
+    tag.append(room);
+    return tag;
+}
+
+// Splits a room-scoped payload into its room name and the remaining text.
+inline bool splitRoomPayload(std::string_view payload, std::string_view& room, std::string_view& text) {
+    if (payload.empty()) {
+        return false;
+    }
+    size_t length = (unsigned char)payload[0];
+    if (length > kMaxRoomName || payload.size() < 1 + length) {
+        return false;
+    }
+    room = payload.substr(1, length);
+    text = payload.substr(1 + length);
+    return true;
+}
+
+inline bool validUserName(std::string_view name) {
+    return !name.empty() && name.size() <= kMaxUserName;
+}
+
+// Splits a server -> client Chat or Notice payload into room, sequence
+// number and the rest.
+inline bool splitSequencedPayload(std::string_view payload, std::string_view& room, uint64_t& sequence, std::string_view& rest) {
+    if (!splitRoomPayload(payload, room, rest) || rest.size() < kSequenceSize) {
+        return false;
+    }
+    sequence = getUint64(rest.data());
+    rest.remove_prefix(kSequenceSize);
+    return true;
+}
+
+// Splits a server -> client chat payload into room, sequence number, sender ID and text.
+inline bool splitChatPayload(std::string_view payload, std::string_view& room, uint64_t& sequence, uint32_t& userId, std::string_view& text) {
+    if (!splitSequencedPayload(payload, room, sequence, text) || text.size() < kUserIdSize) {
+        return false;
+    }
+    userId = getUint32(text.data());
+    text.remove_prefix(kUserIdSize);
+    return true;
+}
+
+// Offset in an encoded server -> client room frame of its sequence number.
+inline size_t sequenceOffset(const char* frame) {
+    return kFrameHeaderSize + 1 + (unsigned char)frame[kFrameHeaderSize];
+}
+
+inline void appendUserId(std::string& out, uint32_t userId) {
+    char id[kUserIdSize];
+    putUint32(id, userId);
+    out.append(id, kUserIdSize);
+}
+
+// Appends one entry of a server -> client Users payload.
+inline void appendUserEntry(std::string& out, uint32_t userId, std::string_view name) {
+    appendUserId(out, userId);
+    out += (char)name.size();
+    out.append(name);
+}
+
+// Calls onEntry(uint32_t id, std::string_view name) for every entry of a
+// server -> client Users payload. False if the payload is malformed.
+template <typename Callback>
+bool parseUserEntries(std::string_view payload, Callback&& onEntry) {
+    while (!payload.empty()) {
+        if (payload.size() < kUserIdSize + 1) {
+            return false;
+        }
+        uint32_t userId = getUint32(payload.data());
+        size_t length = (unsigned char)payload[kUserIdSize];
+        if (payload.size() < kUserIdSize + 1 + length) {
+            return false;
+        }
+        onEntry(userId, payload.substr(kUserIdSize + 1, length));
+        payload.remove_prefix(kUserIdSize + 1 + length);
+    }
+    return true;
+}
+
+inline std::string encodeRoomFrame(FrameType type, std::string_view room, std::string_view text) {
+    return encodeFrame(type, roomTag(room) + std::string(text));
+}
+
+// Incremental frame decoder. Callers recv() large batches into their own
+// buffer and hand them to parse(), which decodes complete frames in place and
+// only copies a trailing partial frame aside until the rest of it arrives.
+// Idle connections therefore hold no read buffer of their own.
+class FrameParser {
+public:
+    // Calls onFrame(const Frame&) for every complete frame. Returns false if the
+    // stream is corrupt (bad version, reserved bits or oversize payload) and
+    // must be dropped. Frame payloads are only valid during the callback.
+    template <typename Callback>
+    bool parse(const char* data, size_t length, Callback&& onFrame) {
+        if (!pending.empty()) {
+            // Complete the frame carried over from the previous batch first.
+            size_t needed = kFrameHeaderSize;
+            if (pending.size() >= kFrameHeaderSize) {
+                needed += getUint32(pending.data());
+            }
+            size_t take = std::min(needed - pending.size(), length);
+            pending.append(data, take);
+            data += take;
+            length -= take;
+
+            if (pending.size() == kFrameHeaderSize && needed == kFrameHeaderSize) {
+                if (!validHeader(pending.data())) {
+                    return false;
+                }
+                needed += getUint32(pending.data());
+                take = std::min(needed - pending.size(), length);
+                pending.append(data, take);
+                data += take;
+                length -= take;
+            }
+            if (pending.size() < needed) {
+                return true;
+            }
+
+            Frame frame;
+            decode(pending.data(), frame);
+            onFrame(frame);
+            pending.clear();
+        }
+
+        while (length >= kFrameHeaderSize) {
+            if (!validHeader(data)) {
+                return false;
+            }
+            size_t frameSize = kFrameHeaderSize + getUint32(data);
+            if (length < frameSize) {
+                break;
+            }
+            Frame frame;
+            decode(data, frame);
+            onFrame(frame);
+            data += frameSize;
+            length -= frameSize;
+        }
+
+        pending.assign(data, length);
+        if (pending.empty()) {
+            pending.shrink_to_fit();  // don't let idle connections pin a large buffer
+        }
+        return true;
+    }
+
+    size_t pendingBytes() const { return pending.size(); }
+
+private:
+    static bool validHeader(const char* header) {
+        return (uint8_t)header[4] == kProtocolVersion
+            && getUint16(header + 6) == 0
+            && getUint32(header) <= kMaxFramePayload;
+    }
+
+    static void decode(const char* header, Frame& frame) {
+        frame.version = (uint8_t)header[4];
+        frame.type = (FrameType)header[5];
+        frame.payload = std::string_view(header + kFrameHeaderSize, getUint32(header));
+    }
+
+    std::string pending;
+};
@@ -0,0 +1,310 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include "ChatClient.h"
+#include "Histogram.h"
+
+// Load generator for the chat server: opens many connections, lets a subset
+// of them send timestamped messages at a fixed rate, and measures how long
+// each broadcast takes to reach every other connection.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 54000;
+    int clients = 100;
+    int senders = 10;
+    double rate = 10.0;      // messages per second per sender
+    int duration = 10;       // seconds of measurement
+    int threads = 0;         // 0 = hardware concurrency
+    int messageSize = 64;    // payload bytes per message
+    int rooms = 1;           // clients are spread round-robin over this many rooms
+};
+
+struct Stats {
+    explicit Stats(int rooms)
+        : roomSent(new std::atomic<uint64_t>[rooms]()), roomMembers(new std::atomic<int>[rooms]()) {
+    }
+
+    std::unique_ptr<std::atomic<uint64_t>[]> roomSent;
+    std::unique_ptr<std::atomic<int>[]> roomMembers;
+    std::atomic<uint64_t> sent{ 0 };
+    std::atomic<uint64_t> received{ 0 };
+    std::atomic<uint64_t> bytesReceived{ 0 };
+    std::atomic<int> connected{ 0 };
+    std::atomic<int> failed{ 0 };
+    std::atomic<int> disconnected{ 0 };
+    std::atomic<uint64_t> sequenceGaps{ 0 };    // room frames a receiver never got
+    std::atomic<uint64_t> outOfOrder{ 0 };      // room frames that arrived after a later one
+};
+
+struct ClientConn {
+    ChatClient client;
+    bool sender = false;
+    int room = 0;
+    std::string roomName;
+    Clock::time_point nextSend;
+    uint64_t lastSequence = 0;  // highest room sequence number received while measuring
+};
+
+std::atomic<bool> measuring{ false };
+std::atomic<bool> stopping{ false };
+
+int64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Checks that a connection sees its room's frames in sequence order without
+// gaps, from the first frame it receives while measuring. Only for
+// connections that don't send: a sender is skipped for its own messages,
+// which would look like gaps.
+void checkSequence(const Frame& frame, ClientConn& conn, Stats& stats) {
+    std::string_view room, rest;
+    uint64_t sequence;
+    if ((frame.type != FrameType::Chat && frame.type != FrameType::Notice)
+        || !splitSequencedPayload(frame.payload, room, sequence, rest) || sequence == 0) {
+        return;
+    }
+    if (!measuring || conn.sender) {
+        return;
+    }
+    if (conn.lastSequence != 0) {
+        if (sequence <= conn.lastSequence) {
+            stats.outOfOrder++;
+        } else {
+            stats.sequenceGaps += sequence - conn.lastSequence - 1;
+        }
+    }
+    conn.lastSequence = std::max(conn.lastSequence, sequence);
+}
+
+// Chat frames come back as <room tag><sequence><sender ID>"<sendTimeNanos> <padding>".
+void recordFrame(const Frame& frame, ClientConn& conn, Histogram& histogram, Stats& stats) {
+    stats.bytesReceived += kFrameHeaderSize + frame.payload.size();
+    checkSequence(frame, conn, stats);
+    std::string_view room, text;
+    uint64_t sequence;
+    uint32_t senderId;
+    if (frame.type != FrameType::Chat || !splitChatPayload(frame.payload, room, sequence, senderId, text)) {
+        return;
+    }
+    int64_t sentAt = std::strtoll(std::string(text.substr(0, 20)).c_str(), nullptr, 10);
+    if (sentAt <= 0) {
+        return;
+    }
+    stats.received++;
+    if (measuring) {
+        histogram.record((uint64_t)std::max<int64_t>(0, (nowNanos() - sentAt) / 1000));
+    }
+}
+
+void runWorker(const Options& options, int firstClient, int clientCount, Stats& stats, Histogram& histogram) {
+    std::vector<ClientConn> conns(clientCount);
+    std::vector<pollfd> fds;
+    auto interval = std::chrono::nanoseconds((int64_t)(1e9 / options.rate));
+
+    for (int i = 0; i < clientCount; ++i) {
+        ClientConn& conn = conns[i];
+        conn.client.setHandler([&](const Frame& frame) { recordFrame(frame, conn, histogram, stats); });
+        if (!conn.client.connect(options.host.c_str(), (uint16_t)options.port)) {
+            stats.failed++;
+            continue;
+        }
+        stats.connected++;
+        conn.sender = firstClient + i < options.senders;
+        // Spread the first sends over one interval so senders don't fire in lockstep.
+        conn.nextSend = Clock::now() + interval * (firstClient + i) / std::max(1, options.senders);
+        conn.client.hello("loadgen-" + std::to_string(firstClient + i));
+
+        conn.room = (firstClient + i) % options.rooms;
+        stats.roomMembers[conn.room]++;
+        if (options.rooms > 1) {
+            conn.roomName = "room-" + std::to_string(conn.room);
+            conn.client.join(conn.roomName);
+            conn.client.leave(kLobbyRoom);
+        } else {
+            conn.roomName = kLobbyRoom;
+        }
+        conn.client.flush();
+    }
+
+    std::string padding(std::max(0, options.messageSize - 20), 'x');
+
+    while (!stopping) {
+        auto now = Clock::now();
+        Clock::time_point wakeAt = now + std::chrono::milliseconds(100);
+
+        fds.clear();
+        for (ClientConn& conn : conns) {
+            if (!conn.client.connected()) {
+                continue;
+            }
+            if (conn.sender && measuring && conn.nextSend <= now) {
+                std::string payload = std::to_string(nowNanos()) + " " + padding;
+                conn.client.chat(conn.roomName, payload);
+                conn.nextSend += interval;
+                if (conn.nextSend < now) {
+                    conn.nextSend = now + interval;  // we fell behind; don't burst to catch up
+                }
+                stats.sent++;
+                stats.roomSent[conn.room]++;
+                conn.client.flush();
+            }
+            if (conn.sender && conn.nextSend < wakeAt) {
+                wakeAt = conn.nextSend;
+            }
+            short events = POLLIN;
+            if (conn.client.wantsWrite()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({ conn.client.socket(), events, 0 });
+        }
+
+        int timeoutMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - Clock::now()).count();
+        if (pollSockets(fds.data(), fds.size(), std::max(0, timeoutMs)) <= 0) {
+            continue;
+        }
+
+        size_t f = 0;
+        for (ClientConn& conn : conns) {
+            if (!conn.client.connected()) {
+                continue;
+            }
+            short revents = fds[f++].revents;
+            bool alive = true;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                alive = conn.client.onReadable();
+            }
+            // Also sends the Pongs queued while reading
+            if (!alive || !conn.client.flush()) {
+                conn.client.close();
+                stats.disconnected++;
+            }
+        }
+    }
+}
+
+void printUsage() {
+    std::cout << "Usage: loadgen [--host ADDR] [--port N] [--clients N] [--senders N]\n"
+                 "               [--rate MSGS_PER_SEC] [--duration SECS] [--threads N] [--size BYTES]\n"
+                 "               [--rooms N]\n";
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = std::atoi(value);
+        else if (arg == "--clients") options.clients = std::atoi(value);
+        else if (arg == "--senders") options.senders = std::atoi(value);
+        else if (arg == "--rate") options.rate = std::atof(value);
+        else if (arg == "--duration") options.duration = std::atoi(value);
+        else if (arg == "--threads") options.threads = std::atoi(value);
+        else if (arg == "--size") options.messageSize = std::atoi(value);
+        else if (arg == "--rooms") options.rooms = std::atoi(value);
+        else return false;
+    }
+    return options.clients > 0 && options.rate > 0 && options.duration > 0 && options.rooms > 0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    if (!netStartup()) {
+        std::cerr << "Failed to initialize Winsock." << std::endl;
+        return 1;
+    }
+
+    int threadCount = options.threads > 0 ? options.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, options.clients);
+    options.senders = std::min(options.senders, options.clients);
+
+    Stats stats(options.rooms);
+    std::vector<Histogram> histograms(threadCount);
+    std::vector<std::thread> workers;
+    int perThread = options.clients / threadCount;
+    int extra = options.clients % threadCount;
+    int first = 0;
+    for (int t = 0; t < threadCount; ++t) {
+        int count = perThread + (t < extra ? 1 : 0);
+        workers.emplace_back(runWorker, std::cref(options), first, count, std::ref(stats), std::ref(histograms[t]));
+        first += count;
+    }
+
+    std::cout << "Connecting " << options.clients << " clients to " << options.host << ":" << options.port
+              << " on " << threadCount << " threads..." << std::endl;
+    while (stats.connected + stats.failed < options.clients) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    std::cout << "Connected: " << stats.connected << ", failed: " << stats.failed << std::endl;
+
+    // Let the join notices settle before measuring.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    measuring = true;
+
+    auto start = Clock::now();
+    uint64_t lastSent = 0, lastReceived = 0, lastBytes = 0;
+    for (int second = 1; second <= options.duration; ++second) {
+        std::this_thread::sleep_for(start + std::chrono::seconds(second) - Clock::now());
+        uint64_t sent = stats.sent, received = stats.received, bytes = stats.bytesReceived;
+        std::cout << "[" << std::setw(3) << second << "s] sent " << (sent - lastSent)
+                  << " msg/s, delivered " << (received - lastReceived)
+                  << " msg/s, " << std::fixed << std::setprecision(1) << (bytes - lastBytes) / 1e6 << " MB/s in"
+                  << ", disconnected " << stats.disconnected << std::endl;
+        lastSent = sent;
+        lastReceived = received;
+        lastBytes = bytes;
+    }
+    measuring = false;
+
+    // Give in-flight messages a moment to arrive before stopping.
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    stopping = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    Histogram merged;
+    for (const auto& histogram : histograms) {
+        merged.merge(histogram);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Each message reaches every other member of its room.
+    uint64_t expected = 0;
+    for (int room = 0; room < options.rooms; ++room) {
+        expected += stats.roomSent[room] * (uint64_t)std::max(0, stats.roomMembers[room] - 1);
+    }
+
+    std::cout << "\nMessages sent:        " << stats.sent
+              << "\nDeliveries received:  " << stats.received
+              << "\nExpected deliveries:  " << expected
+              << "\nSequence gaps:        " << stats.sequenceGaps
+              << "\nOut of order:         " << stats.outOfOrder
+              << "\nDelivery throughput:  " << std::fixed << std::setprecision(0) << stats.received / elapsed << " msg/s"
+              << "\nFan-out latency (us): p50 " << merged.percentile(0.5)
+              << "  p90 " << merged.percentile(0.9)
+              << "  p99 " << merged.percentile(0.99)
+              << "  p99.9 " << merged.percentile(0.999)
+              << "  max " << merged.max() << std::endl;
+
+    netCleanup();
+    return 0;
+}
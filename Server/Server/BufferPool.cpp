@@ -0,0 +1,119 @@
+#include "BufferPool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include "Metrics.h"
+
+namespace {
+    const size_t kMinClassShift = 6;        // 64-byte blocks
+    const size_t kClassCount = 12;          // up to 128 KiB: a maximum-size frame fits
+    const size_t kSlabBytes = 256 * 1024;   // smaller classes are carved this many bytes at a time
+    const size_t kMinBlocksPerSlab = 4;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct ThreadPool;
+
+    // Precedes every block. Padded so the block itself stays max-aligned.
+    struct alignas(alignof(std::max_align_t)) BlockHeader {
+        ThreadPool* owner;      // nullptr for blocks from operator new
+        uint32_t sizeClass;
+    };
+
+    // One thread's free lists, plus the stacks other threads return its blocks to.
+    struct ThreadPool {
+        FreeBlock* local[kClassCount] = {};
+        std::atomic<FreeBlock*> returned[kClassCount] = {};
+    };
+
+    size_t classSize(size_t sizeClass) {
+        return (size_t)1 << (kMinClassShift + sizeClass);
+    }
+
+    size_t classOf(size_t bytes) {
+        size_t sizeClass = 0;
+        while (sizeClass < kClassCount && classSize(sizeClass) < bytes) {
+            ++sizeClass;
+        }
+        return sizeClass;
+    }
+
+    BlockHeader* headerOf(void* block) {
+        return static_cast<BlockHeader*>(block) - 1;
+    }
+
+    // Outlives its thread: blocks it handed out may be released later.
+    ThreadPool& localPool() {
+        thread_local ThreadPool* pool = new ThreadPool();
+        return *pool;
+    }
+
+    // Carves a new slab into blocks of the class and puts them on the free list.
+    void grow(ThreadPool& pool, size_t sizeClass) {
+        size_t stride = sizeof(BlockHeader) + classSize(sizeClass);
+        size_t count = kSlabBytes / stride > kMinBlocksPerSlab ? kSlabBytes / stride : kMinBlocksPerSlab;
+        char* slab = static_cast<char*>(::operator new(stride * count));
+        countEvent(Counter::PoolSlabs);
+        for (size_t i = 0; i < count; ++i) {
+            BlockHeader* header = reinterpret_cast<BlockHeader*>(slab + i * stride);
+            header->owner = &pool;
+            header->sizeClass = (uint32_t)sizeClass;
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(header + 1);
+            block->next = pool.local[sizeClass];
+            pool.local[sizeClass] = block;
+        }
+    }
+}
+
+void* poolAllocate(size_t bytes) {
+    size_t sizeClass = classOf(bytes);
+    if (sizeClass == kClassCount) {
+        BlockHeader* header = static_cast<BlockHeader*>(::operator new(sizeof(BlockHeader) + bytes));
+        header->owner = nullptr;
+        countEvent(Counter::PoolOversize);
+        return header + 1;
+    }
+
+    ThreadPool& pool = localPool();
+    FreeBlock* block = pool.local[sizeClass];
+    if (block == nullptr) {
+        block = pool.returned[sizeClass].exchange(nullptr, std::memory_order_acquire);
+        if (block == nullptr) {
+            grow(pool, sizeClass);
+            block = pool.local[sizeClass];
+        }
+    }
+    pool.local[sizeClass] = block->next;
+    countEvent(Counter::PoolAllocations);
+    return block;
+}
+
+void poolRelease(void* memory) {
+    if (memory == nullptr) {
+        return;
+    }
+    BlockHeader* header = headerOf(memory);
+    ThreadPool* owner = header->owner;
+    if (owner == nullptr) {
+        ::operator delete(header);
+        return;
+    }
+
+    size_t sizeClass = header->sizeClass;
+    FreeBlock* block = static_cast<FreeBlock*>(memory);
+    if (owner == &localPool()) {
+        block->next = owner->local[sizeClass];
+        owner->local[sizeClass] = block;
+        return;
+    }
+
+    // Push-only on this side and take-all on the owner's, so there is no ABA
+    FreeBlock* head = owner->returned[sizeClass].load(std::memory_order_relaxed);
+    do {
+        block->next = head;
+    } while (!owner->returned[sizeClass].compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+    countEvent(Counter::PoolRemoteReleases);
+}
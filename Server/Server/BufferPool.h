@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+
+// Per-thread slab pool for the buffers that live on the hot path: encoded
+// frames and outbound queue storage.
+//
+// Each thread carves power-of-two size classes out of slabs it never gives
+// back, and keeps a free list per class. A block freed on another thread is
+// pushed onto its owner's lock-free return stack, which the owner takes over
+// wholesale the next time its own free list runs dry, so blocks always go
+// home and no thread ever locks. Once every class has grown to the working
+// set, allocating and freeing a block never reaches the global allocator.
+//
+// Requests above the largest class fall through to operator new.
+
+// Returns a block of at least bytes bytes, aligned for any fundamental type.
+void* poolAllocate(size_t bytes);
+
+// Returns a block from poolAllocate. May be called from any thread.
+void poolRelease(void* block);
@@ -0,0 +1,57 @@
+#include "ClientRegistry.h"
+
+ClientRegistry::ClientRegistry()
+    : current(new Snapshot) {
+}
+
+ClientRegistry::~ClientRegistry() {
+    delete current.load();
+}
+
+void ClientRegistry::publish(Snapshot* next) {
+    const Snapshot* previous = current.exchange(next, std::memory_order_seq_cst);
+    retire(previous);
+}
+
+void ClientRegistry::add(const std::shared_ptr<Connection>& conn) {
+    std::lock_guard<std::mutex> guard(writerMutex);
+    const Snapshot* snapshot = current.load(std::memory_order_relaxed);
+
+    if (!owners.emplace(conn.get(), conn).second) {
+        return;
+    }
+
+    Snapshot* next = new Snapshot;
+    next->members.reserve(snapshot->members.size() + 1);
+    next->members = snapshot->members;
+    next->members.push_back(conn.get());
+    publish(next);
+}
+
+bool ClientRegistry::remove(const Connection* conn) {
+    std::lock_guard<std::mutex> guard(writerMutex);
+    auto owner = owners.find(conn);
+    if (owner == owners.end()) {
+        return false;
+    }
+    const Snapshot* snapshot = current.load(std::memory_order_relaxed);
+
+    Snapshot* next = new Snapshot;
+    next->members.reserve(snapshot->members.size() - 1);
+    for (Connection* member : snapshot->members) {
+        if (member != conn) {
+            next->members.push_back(member);
+        }
+    }
+    publish(next);
+
+    // Readers of the old snapshot may still be using the connection
+    retire(new std::shared_ptr<Connection>(std::move(owner->second)));
+    owners.erase(owner);
+    return true;
+}
+
+size_t ClientRegistry::size() const {
+    EpochGuard guard;
+    return current.load(std::memory_order_seq_cst)->members.size();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "Connection.h"
+#include "Epoch.h"
+
+// Set of live connections, read far more often (every broadcast) than it is
+// written (connect/disconnect). Readers iterate an immutable snapshot without
+// taking any lock; writers copy the snapshot, apply their change, publish the
+// copy with one atomic store and retire the old one through Epoch.h. Writers
+// serialize among themselves but never block a broadcast in progress.
+//
+// Snapshots hold plain pointers, so publishing one copies 8 bytes per member
+// without touching reference counts; that copy still makes each add and
+// remove O(members). The registry keeps its references to the connections
+// beside the snapshots and retires a removed one through Epoch.h as well, so
+// it outlives every reader that may still reach it through an old snapshot.
+class ClientRegistry {
+public:
+    ClientRegistry();
+    ~ClientRegistry();
+
+    ClientRegistry(const ClientRegistry&) = delete;
+    ClientRegistry& operator=(const ClientRegistry&) = delete;
+
+    void add(const std::shared_ptr<Connection>& conn);
+    bool remove(const Connection* conn);
+    size_t size() const;
+
+    // Calls fn(Connection&) for every member of the current snapshot.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        EpochGuard guard;
+        const Snapshot* snapshot = current.load(std::memory_order_seq_cst);
+        for (const auto& member : snapshot->members) {
+            fn(*member);
+        }
+    }
+
+private:
+    struct Snapshot {
+        std::vector<Connection*> members;
+    };
+
+    void publish(Snapshot* next);
+
+    std::mutex writerMutex;
+    std::unordered_map<const Connection*, std::shared_ptr<Connection>> owners;  // guarded by writerMutex
+    std::atomic<const Snapshot*> current;
+};
@@ -0,0 +1,551 @@
+#include "Connection.h"
+
+#include <algorithm>
+#include <cstdint>
+#include "Logger.h"
+#include "Metrics.h"
+
+
+namespace {
+    // Bounds the reads done per readiness event so one busy client cannot
+    // starve the rest of the loop; level-triggered polling brings us back.
+    const int kMaxReadsPerEvent = 4;
+
+    // Every connection on a loop reads into the same large buffer; only a
+    // trailing partial frame is copied into the connection's parser.
+    const size_t kReadBufferSize = 64 * 1024;
+    thread_local char readBuffer[kReadBufferSize];
+
+    // Bounds what may wait for a single client, so a peer that stops reading
+    // costs a bounded amount of memory and never holds up anyone else.
+    OutboundLimits outboundLimits;
+
+    Keepalive keepalive;
+
+    // How far frames for the client alone (queueControl()) may go past the
+    // byte limit; enough for a full Users reply.
+    const size_t kControlHeadroom = 64 * 1024;
+
+    // Room traffic is Chat and the Notices tagged with a room; everything
+    // else a client is sent was queued for it alone, by queueControl(), and
+    // the overflow policy leaves it be.
+    bool isControlFrame(const SharedFrame& frame) {
+        FrameType type = (FrameType)frame.data()[5];
+        return type != FrameType::Chat && (type != FrameType::Notice || frame.data()[kFrameHeaderSize] == 0);
+    }
+
+    // Frames gathered into one vectored send; well under IOV_MAX.
+    const size_t kMaxFramesPerSend = 64;
+}
+
+bool parseOverflowPolicy(std::string_view name, OverflowPolicy& policy) {
+    if (name == "drop-oldest") policy = OverflowPolicy::DropOldest;
+    else if (name == "disconnect") policy = OverflowPolicy::Disconnect;
+    else if (name == "summarize") policy = OverflowPolicy::Summarize;
+    else return false;
+    return true;
+}
+
+void Connection::setOutboundLimits(const OutboundLimits& limits) {
+    outboundLimits = limits;
+}
+
+void Connection::setKeepalive(const Keepalive& settings) {
+    keepalive = settings;
+}
+
+Connection::Connection(SOCKET s, EventLoop& loop)
+    : sock(s), ownerLoop(loop) {
+}
+
+Connection::~Connection() {
+    if (sock != INVALID_SOCKET) {
+        closesocket(sock);
+    }
+}
+
+void Connection::start() {
+    self = shared_from_this();
+    if (!ownerLoop.add(sock, this)) {
+        logError("Failed to register client socket with event loop. Error: ", lastSocketError());
+        close();
+        return;
+    }
+    lastReceive = metricsNow();
+    armIdleTimer(TimerWheel::nowMs());
+}
+
+void Connection::close() {
+    if (closed) {
+        return;
+    }
+    closed = true;
+    ownerLoop.remove(sock);
+    // The descriptor goes with the object, which readers of a room's old
+    // membership snapshot may keep alive a little longer; the peer should
+    // see the close now
+    shutdown(sock, SD_BOTH);
+    idleTimer.cancel();
+
+    {
+        std::lock_guard<std::mutex> guard(outMutex);
+        outQueue.clear();
+        queuedBytes = 0;
+        pinnedFrames = 0;
+        skippedFrames = 0;
+        catchUpEnd = 0;
+    }
+
+    resumeReader(nullptr);
+
+    // Other handlers later in the current dispatch batch may still reference
+    // this object, so the final release is deferred to the end of the batch.
+    std::shared_ptr<Connection> keepAlive = std::move(self);
+    ownerLoop.post([keepAlive]() {});
+}
+
+// Hands a frame (or nullptr at close) to the coroutine awaiting nextFrame().
+// Frames arriving after the coroutine has finished are ignored.
+void Connection::resumeReader(const Frame* frame) {
+    if (!reader) {
+        return;
+    }
+    std::coroutine_handle<> handle = reader;
+    reader = nullptr;
+    deliveredFrame = frame;
+    handle.resume();
+}
+
+// Feeds received bytes to the parser. False if the connection was closed.
+bool Connection::handleData(const char* data, int length) {
+    lastReceive = metricsNow();
+    pingSent = false;
+    bool valid = parser.parse(data, length, [this](const Frame& frame) {
+        // A Pong only proves the peer is alive, which lastReceive now records
+        if (!closed && frame.type != FrameType::Pong) {
+            resumeReader(&frame);
+        }
+    });
+    if (!valid) {
+        logError("Malformed frame from client, closing connection.");
+        close();
+        return false;
+    }
+    return !closed;
+}
+
+void Connection::onReadable() {
+    for (int i = 0; i < kMaxReadsPerEvent && !closed; ++i) {
+        int bytesReceived = recv(sock, readBuffer, (int)kReadBufferSize, 0);
+        if (bytesReceived > 0) {
+            if (!handleData(readBuffer, bytesReceived)) {
+                return;
+            }
+            if (bytesReceived < (int)kReadBufferSize) {
+                return;  // drained the socket; no need for another recv() to see EWOULDBLOCK
+            }
+            continue;
+        }
+        if (bytesReceived == SOCKET_ERROR && isWouldBlock(lastSocketError())) {
+            return;
+        }
+        // Orderly shutdown (0) or a hard error: either way the client is gone.
+        close();
+        return;
+    }
+}
+
+// Completion loops deliver data already read into a ring buffer.
+void Connection::onReceived(const char* data, int result) {
+    if (closed) {
+        return;
+    }
+    if (result > 0) {
+        handleData(data, result);
+        return;
+    }
+    close();
+}
+
+void Connection::onWritable() {
+    flush();
+}
+
+// Receiving data does not touch the timer; when it fires the deadlines are
+// recomputed from lastReceive, so a busy connection costs one check per
+// interval rather than a timer update per recv().
+void Connection::armIdleTimer(uint64_t nowMs) {
+    // lastReceive is metricsNow(), on the same steady clock in nanoseconds
+    uint64_t heardMs = lastReceive / 1000000;
+    uint64_t deadline = UINT64_MAX;
+    if (pingsEnabled && !pingSent && keepalive.pingIntervalMs != 0) {
+        deadline = heardMs + keepalive.pingIntervalMs;
+    }
+    if (keepalive.idleTimeoutMs != 0) {
+        deadline = std::min(deadline, heardMs + keepalive.idleTimeoutMs);
+    }
+    if (deadline != UINT64_MAX) {
+        ownerLoop.timers().schedule(idleTimer, deadline > nowMs ? deadline - nowMs : 0);
+    }
+}
+
+void Connection::onTimer() {
+    if (closed) {
+        return;
+    }
+    uint64_t nowMs = TimerWheel::nowMs();
+    uint64_t idleMs = nowMs - std::min(nowMs, lastReceive / 1000000);
+    if (keepalive.idleTimeoutMs != 0 && idleMs >= keepalive.idleTimeoutMs) {
+        if (name.empty()) {
+            logInfo("Connection was silent for ", idleMs / 1000, " s. Closing it.");
+        } else {
+            logInfo("Client '", name, "' was silent for ", idleMs / 1000, " s. Closing connection.");
+        }
+        close();
+        return;
+    }
+    if (pingsEnabled && !pingSent && keepalive.pingIntervalMs != 0 && idleMs >= keepalive.pingIntervalMs) {
+        pingSent = true;
+        queueControl(SharedFrame::encode(FrameType::Ping, {}));
+    }
+    armIdleTimer(nowMs);
+}
+
+bool Connection::queueSend(const SharedFrame& frame) {
+    bool scheduleFlush = false;
+    bool disconnect = false;
+    {
+        std::lock_guard<std::mutex> guard(outMutex);
+        if (closed || overflowed) {
+            return false;
+        }
+        // Summarize: skip everything until the backlog has drained
+        if (skippedFrames != 0) {
+            dropFrame(frame);
+            ++skippedFrames;
+            return false;
+        }
+
+        if (overLimits(frame.size())) {
+            switch (outboundLimits.policy) {
+            case OverflowPolicy::DropOldest: {
+                size_t oldest = pinnedFrames;
+                while (overLimits(frame.size())) {
+                    while (oldest < outQueue.size() && isControlFrame(outQueue[oldest])) {
+                        ++oldest;
+                    }
+                    if (oldest == outQueue.size()) {
+                        break;
+                    }
+                    dropFrame(outQueue[oldest]);
+                    queuedBytes -= outQueue[oldest].size();
+                    outQueue.erase(oldest);
+                    if (catchUps != 0 && oldest < catchUpEnd) {
+                        --catchUpEnd;
+                    }
+                }
+                if (overLimits(frame.size())) {
+                    dropFrame(frame);
+                    return false;
+                }
+                break;
+            }
+
+            case OverflowPolicy::Disconnect:
+                overflowed = true;
+                disconnect = true;
+                break;
+
+            case OverflowPolicy::Summarize: {
+                std::vector<SharedFrame> kept;
+                while (outQueue.size() > pinnedFrames) {
+                    if (isControlFrame(outQueue.back())) {
+                        kept.push_back(outQueue.back());
+                    } else {
+                        dropFrame(outQueue.back());
+                        queuedBytes -= outQueue.back().size();
+                        ++skippedFrames;
+                    }
+                    outQueue.pop_back();
+                }
+                for (auto it = kept.rbegin(); it != kept.rend(); ++it) {
+                    outQueue.push_back(*it);
+                }
+                catchUpEnd = std::min(catchUpEnd, outQueue.size());
+                dropFrame(frame);
+                ++skippedFrames;
+                return false;
+            }
+            }
+        }
+
+        if (!disconnect) {
+            queuedBytes += frame.size();
+            outQueue.push_back(frame);
+            recordMetric(Metric::QueueDepth, outQueue.size());
+            if (!flushScheduled) {
+                flushScheduled = true;
+                scheduleFlush = true;
+            }
+        }
+    }
+
+    std::shared_ptr<Connection> conn = shared_from_this();
+    if (disconnect) {
+        countEvent(Counter::SlowDisconnects);
+        ownerLoop.post([conn]() {
+            logWarn("Client '", conn->name, "' is not keeping up with its messages. Closing connection.");
+            conn->close();
+        });
+        return false;
+    }
+    if (scheduleFlush) {
+        ownerLoop.post([conn]() { conn->flush(); });
+    }
+    return true;
+}
+
+size_t Connection::queueSend(const SharedFrame* frames, size_t count) {
+    size_t queued = 0;
+    bool scheduleFlush = false;
+    {
+        std::lock_guard<std::mutex> guard(outMutex);
+        if (closed || overflowed || skippedFrames != 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (overLimits(frames[i].size())) {
+                dropFrame(frames[i]);
+                continue;
+            }
+            queuedBytes += frames[i].size();
+            outQueue.push_back(frames[i]);
+            ++queued;
+        }
+        if (queued != 0 && !flushScheduled) {
+            flushScheduled = true;
+            scheduleFlush = true;
+        }
+    }
+
+    if (scheduleFlush) {
+        std::shared_ptr<Connection> conn = shared_from_this();
+        ownerLoop.post([conn]() { conn->flush(); });
+    }
+    return queued;
+}
+
+bool Connection::queueControl(const SharedFrame& frame) {
+    bool scheduleFlush = false;
+    {
+        std::lock_guard<std::mutex> guard(outMutex);
+        if (closed || overflowed) {
+            return false;
+        }
+        if (queuedBytes + frame.size() > outboundLimits.maxBytes + kControlHeadroom) {
+            dropFrame(frame);
+            return false;
+        }
+        queuedBytes += frame.size();
+        outQueue.push_back(frame);
+        if (!flushScheduled) {
+            flushScheduled = true;
+            scheduleFlush = true;
+        }
+    }
+
+    if (scheduleFlush) {
+        std::shared_ptr<Connection> conn = shared_from_this();
+        ownerLoop.post([conn]() { conn->flush(); });
+    }
+    return true;
+}
+
+void Connection::holdForCatchUp() {
+    std::lock_guard<std::mutex> guard(outMutex);
+    if (catchUps++ == 0) {
+        catchUpEnd = outQueue.size();
+    }
+}
+
+void Connection::finishCatchUp(const SharedFrame* frames, size_t count) {
+    bool scheduleFlush = false;
+    {
+        std::lock_guard<std::mutex> guard(outMutex);
+        if (!closed && !overflowed && skippedFrames == 0) {
+            for (size_t i = 0; i < count; ++i) {
+                if (overLimits(frames[i].size())) {
+                    dropFrame(frames[i]);
+                    continue;
+                }
+                queuedBytes += frames[i].size();
+                outQueue.insert(catchUpEnd++, frames[i]);
+            }
+        }
+        // A later hold goes on from after these frames
+        if (--catchUps == 0 && !closed && !outQueue.empty() && !flushScheduled) {
+            flushScheduled = true;
+            scheduleFlush = true;
+        }
+    }
+
+    if (scheduleFlush) {
+        std::shared_ptr<Connection> conn = shared_from_this();
+        ownerLoop.post([conn]() { conn->flush(); });
+    }
+}
+
+// Frames at the front of the queue that may go out now. Caller holds outMutex.
+size_t Connection::sendableFrames() const {
+    return catchUps != 0 ? catchUpEnd : outQueue.size();
+}
+
+// True if queueing extraBytes more in one frame would exceed the limits.
+// Caller holds outMutex.
+bool Connection::overLimits(size_t extraBytes) const {
+    return queuedBytes + extraBytes > outboundLimits.maxBytes || outQueue.size() + 1 > outboundLimits.maxFrames;
+}
+
+// Counts a frame lost to the overflow policy.
+void Connection::dropFrame(const SharedFrame& frame) {
+    countEvent(Counter::FramesDropped);
+    countEvent(Counter::BytesDropped, frame.size());
+}
+
+// Queues the notice that replaces the frames skipped under Summarize, once
+// the client has read everything queued before them. Caller holds outMutex.
+void Connection::queueSummary() {
+    SharedFrame summary = SharedFrame::encode(FrameType::Notice, { roomTag(""), kNoSequence,
+        "You fell behind; ", std::to_string(skippedFrames), " messages were skipped." });
+    skippedFrames = 0;
+    queuedBytes += summary.size();
+    outQueue.push_back(summary);
+    countEvent(Counter::SummariesSent);
+}
+
+// Drains the outbound queue until it is empty or the socket would block, in
+// which case write interest is armed and onWritable() resumes the flush.
+// Senders only ever push, so the lock is not held across send().
+void Connection::flush() {
+    if (ownerLoop.completionBased()) {
+        submitNextSend();
+        return;
+    }
+
+    IoBuffer buffers[kMaxFramesPerSend];
+    while (!closed) {
+        // Frame data lives in the shared blocks, which only this thread
+        // releases, so the pointers stay valid after the lock is dropped.
+        size_t count = 0;
+        {
+            std::lock_guard<std::mutex> guard(outMutex);
+            if (outQueue.empty() && skippedFrames != 0) {
+                queueSummary();
+            }
+            size_t sendable = sendableFrames();
+            if (sendable == 0) {
+                flushScheduled = false;
+                break;
+            }
+            size_t offset = writeOffset;
+            for (; count < sendable && count < kMaxFramesPerSend; ++count) {
+                const SharedFrame& frame = outQueue[count];
+                setIoBuffer(buffers[count], frame.data() + offset, frame.size() - offset);
+                offset = 0;
+            }
+            pinnedFrames = count;
+        }
+
+        int result = sendBuffers(sock, buffers, count);
+        if (result == SOCKET_ERROR) {
+            if (isWouldBlock(lastSocketError())) {
+                completeSend(0);  // unpins the gathered frames
+                if (!writeInterest) {
+                    writeInterest = true;
+                    ownerLoop.setWriteInterest(sock, this, true);
+                }
+                return;
+            }
+            logError("Failed to send message to a client. Error: ", lastSocketError());
+            close();
+            return;
+        }
+        completeSend(result);
+    }
+
+    if (writeInterest && !closed) {
+        writeInterest = false;
+        ownerLoop.setWriteInterest(sock, this, false);
+    }
+}
+
+// Completion loops keep one gathered send in flight per connection; onSent()
+// moves on to whatever queued meanwhile. The sends of every connection
+// flushed in the same loop iteration reach the kernel in one submission.
+void Connection::submitNextSend() {
+    if (closed || sendInFlight) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(outMutex);
+        if (outQueue.empty() && skippedFrames != 0) {
+            queueSummary();
+        }
+        size_t sendable = sendableFrames();
+        if (sendable == 0) {
+            flushScheduled = false;
+            return;
+        }
+        for (size_t i = 0; i < sendable && i < kMaxFramesPerSend; ++i) {
+            sendBatch.push_back(outQueue[i]);
+        }
+        pinnedFrames = sendBatch.size();
+    }
+
+    sendInFlight = true;
+    if (!ownerLoop.submitSend(sock, this, sendBatch, writeOffset)) {
+        sendBatch.clear();
+        logError("Failed to submit a send to a client.");
+        close();
+    }
+}
+
+void Connection::onSent(int result) {
+    sendInFlight = false;
+    if (closed) {
+        return;
+    }
+    if (result < 0) {
+        logError("Failed to send message to a client. Error: ", -result);
+        close();
+        return;
+    }
+    completeSend(result);
+    submitNextSend();
+}
+
+// Accounts for bytes that reached the socket, retiring every frame they
+// complete; a gathered send can finish several frames and part of the next.
+// Only a partly sent front frame stays pinned afterwards.
+void Connection::completeSend(size_t bytes) {
+    std::lock_guard<std::mutex> guard(outMutex);
+    while (bytes > 0) {
+        const SharedFrame& front = outQueue.front();
+        size_t remaining = front.size() - writeOffset;
+        if (bytes < remaining) {
+            writeOffset += bytes;
+            break;
+        }
+        bytes -= remaining;
+        if (front.receivedAt() != 0) {
+            recordMetric(Metric::ReceiveToSend, metricsNow() - front.receivedAt());
+        }
+        queuedBytes -= front.size();
+        outQueue.pop_front();
+        writeOffset = 0;
+        if (catchUps != 0) {
+            --catchUpEnd;
+        }
+    }
+    pinnedFrames = writeOffset != 0 ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "EventLoop.h"
+#include "FrameQueue.h"
+#include "Protocol.h"
+#include "SharedFrame.h"
+
+class Room;
+
+// What a connection does when a frame would push its outbound queue past the
+// limits, i.e. when its client reads slower than the chat it is subscribed to.
+enum class OverflowPolicy {
+    DropOldest,     // discard the oldest queued frames to make room
+    Disconnect,     // close the connection
+    Summarize,      // discard the backlog and, once caught up, tell the client how many messages it missed
+};
+
+bool parseOverflowPolicy(std::string_view name, OverflowPolicy& policy);
+
+struct OutboundLimits {
+    size_t maxBytes = 1024 * 1024;
+    size_t maxFrames = 4096;
+    OverflowPolicy policy = OverflowPolicy::DropOldest;
+};
+
+// How quiet a connection may get. A connection that has sent nothing for
+// pingIntervalMs is sent a Ping, and one that stays silent for idleTimeoutMs
+// is closed; 0 disables either.
+struct Keepalive {
+    uint64_t pingIntervalMs = 30 * 1000;
+    uint64_t idleTimeoutMs = 90 * 1000;
+};
+
+// One accepted client socket multiplexed on an EventLoop. The connection keeps
+// itself alive while registered and hands the frames it decodes to a
+// coroutine awaiting nextFrame(), so the chat logic reads as straight-line
+// code without owning a thread per client.
+class Connection : public IoHandler, public std::enable_shared_from_this<Connection> {
+public:
+    // Suspends the awaiting coroutine until the next frame arrives, resuming
+    // it with a pointer to the frame, valid until the coroutine next
+    // suspends, or with nullptr once the connection is closed. Only one
+    // coroutine may await a connection.
+    class FrameAwaiter {
+    public:
+        explicit FrameAwaiter(Connection& conn) : conn(conn) {}
+        bool await_ready() const noexcept { return conn.closed; }
+        void await_suspend(std::coroutine_handle<> handle) noexcept { conn.reader = handle; }
+        const Frame* await_resume() const noexcept { return conn.closed ? nullptr : conn.deliveredFrame; }
+
+    private:
+        Connection& conn;
+    };
+
+    Connection(SOCKET s, EventLoop& loop);
+    ~Connection();
+
+    SOCKET socket() const { return sock; }
+    EventLoop& loop() const { return ownerLoop; }
+    bool isClosed() const { return closed; }
+    // metricsNow() at the recv() that delivered the frame being handled.
+    uint64_t receivedAt() const { return lastReceive; }
+
+    // Limits applied to every connection's outbound queue. Set before any
+    // connection is started.
+    static void setOutboundLimits(const OutboundLimits& limits);
+    // Idle detection applied to every connection. Set before any connection
+    // is started.
+    static void setKeepalive(const Keepalive& keepalive);
+
+    // Stops pinging this connection; its peer is expected to send its own
+    // heartbeats (relay links, which never read). Idle timeout still applies.
+    void disablePings() { pingsEnabled = false; }
+
+    // Appends a frame to the outbound queue and schedules a flush on the owning
+    // loop. Safe to call from any thread; never blocks on the socket. Returns
+    // false if the connection is closed or the frame was dropped by the
+    // overflow policy.
+    bool queueSend(const SharedFrame& frame);
+    // Appends the frames in order under one lock and schedules one flush.
+    // Frames that would overflow the queue are dropped and counted rather
+    // than handed to the overflow policy. Returns how many were queued.
+    size_t queueSend(const SharedFrame* frames, size_t count);
+    // Queues a frame meant for this client alone (a reply, ping or notice)
+    // past the overflow policy, which never drops it to make room either, so
+    // a client that fell behind on room traffic still hears about its own
+    // requests. Such frames may exceed the byte limit by kControlHeadroom;
+    // beyond that they are dropped. Same threading and return value as
+    // queueSend().
+    bool queueControl(const SharedFrame& frame);
+
+    // Catching up from the message log happens off the loop, after frames
+    // that must follow the catch-up may already be queued. Each
+    // holdForCatchUp() marks the end of the queue and stops sends there until
+    // the matching finishCatchUp() inserts its frames at that point; frames
+    // over the limits are dropped as in the batch queueSend(). Holds nest and
+    // are released in the order they were taken. Safe to call from any thread.
+    void holdForCatchUp();
+    void finishCatchUp(const SharedFrame* frames, size_t count);
+
+    // Registers the socket with the owning loop. Must run on the loop thread.
+    void start();
+    // Unregisters the socket and shuts it down, resuming the reader with
+    // nullptr. The descriptor is released with the object. Must run on the
+    // loop thread.
+    void close();
+
+    // co_await conn.nextFrame() on the loop thread.
+    FrameAwaiter nextFrame() { return FrameAwaiter(*this); }
+
+    void onReadable() override;
+    void onWritable() override;
+    void onReceived(const char* data, int result) override;
+    void onSent(int result) override;
+    void onTimer() override;
+
+    // Chat state, owned by the loop thread.
+    std::string name;
+    uint32_t userId = 0;
+    std::map<std::string, std::shared_ptr<Room>, std::less<>> rooms;  // rooms joined
+
+private:
+    bool handleData(const char* data, int length);
+    void resumeReader(const Frame* frame);
+    void flush();
+    void submitNextSend();
+    void completeSend(size_t bytes);
+    bool overLimits(size_t extraBytes) const;
+    size_t sendableFrames() const;
+    void dropFrame(const SharedFrame& frame);
+    void queueSummary();
+    void armIdleTimer(uint64_t nowMs);
+
+    SOCKET sock;
+    EventLoop& ownerLoop;
+    std::atomic<bool> closed{ false };
+    FrameParser parser;                 // loop thread
+    std::coroutine_handle<> reader;     // loop thread: the coroutine awaiting nextFrame()
+    const Frame* deliveredFrame = nullptr; // loop thread: what the reader is resumed with
+    uint64_t lastReceive = 0;           // loop thread
+    Timer idleTimer{ this };            // loop thread: next keepalive check, re-armed lazily
+    bool pingsEnabled = true;           // loop thread
+    bool pingSent = false;              // loop thread: a Ping is unanswered since lastReceive
+
+    std::mutex outMutex;
+    FrameQueue outQueue;                // guarded by outMutex; only the loop pops
+    size_t queuedBytes = 0;             // guarded by outMutex
+    bool flushScheduled = false;        // guarded by outMutex
+    size_t pinnedFrames = 0;            // guarded by outMutex: front frames handed to a send, never dropped
+    size_t skippedFrames = 0;           // guarded by outMutex: dropped since the last summary (Summarize)
+    bool overflowed = false;            // guarded by outMutex: closing for overflow (Disconnect)
+    size_t catchUps = 0;                // guarded by outMutex: holds not yet finished
+    size_t catchUpEnd = 0;              // guarded by outMutex: while held, frames from here on wait
+    size_t writeOffset = 0;             // loop thread: bytes of outQueue.front() already sent
+    bool writeInterest = false;         // loop thread
+    bool sendInFlight = false;          // loop thread, completion loops only
+    std::vector<SharedFrame> sendBatch; // loop thread, completion loops only: frames handed to submitSend
+    std::shared_ptr<Connection> self;  // held while registered with the loop
+};
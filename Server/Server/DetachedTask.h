@@ -0,0 +1,45 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include "BufferPool.h"
+#include "Connection.h"
+#include "Logger.h"
+
+// Return type of a fire-and-forget coroutine. It runs as soon as it is called
+// until its first suspension, is resumed by whatever it awaits, and frees its
+// frame when it finishes; nobody holds or awaits the task itself. Frames come
+// from the buffer pool.
+//
+// Tasks are sessions taking their connection as the first parameter.
+struct DetachedTask {
+    struct promise_type {
+        // The frame's copy of the parameter keeps the connection alive.
+        template <typename... Args>
+        promise_type(const std::shared_ptr<Connection>& conn, const Args&...) noexcept : conn(conn.get()) {}
+
+        DetachedTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        // The server does not use exceptions, so one escaping a session is a
+        // bug; it costs that session its connection rather than the process.
+        void unhandled_exception() noexcept {
+            try {
+                throw;
+            } catch (const std::exception& error) {
+                logError("Session failed: ", error.what(), ". Closing connection.");
+            } catch (...) {
+                logError("Session failed. Closing connection.");
+            }
+            conn->close();
+        }
+
+        static void* operator new(size_t size) { return poolAllocate(size); }
+        static void operator delete(void* frame) noexcept { poolRelease(frame); }
+
+        Connection* conn;
+    };
+};
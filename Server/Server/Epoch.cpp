@@ -0,0 +1,132 @@
+#include "Epoch.h"
+
+#include <mutex>
+#include <vector>
+
+namespace epochdetail {
+    const uint64_t kQuiescent = 0;
+
+    struct ReaderRecord {
+        std::atomic<uint64_t> epoch{ kQuiescent };  // epoch observed on entry, 0 when outside
+        std::atomic<bool> inUse{ true };
+        ReaderRecord* next = nullptr;
+        unsigned depth = 0;                         // owning thread only; guards may nest
+    };
+}
+
+namespace {
+    using epochdetail::ReaderRecord;
+    using epochdetail::kQuiescent;
+
+    struct Retired {
+        uint64_t epoch;
+        void* object;
+        void (*deleter)(void*);
+    };
+
+    std::atomic<uint64_t> globalEpoch{ 1 };
+    std::atomic<ReaderRecord*> readers{ nullptr };  // append-only list, records are recycled
+
+    std::mutex retiredMutex;
+    std::vector<Retired> retired;               // guarded by retiredMutex
+    std::atomic<size_t> retiredCount{ 0 };      // retired.size(), read without the lock
+
+    ReaderRecord* acquireRecord() {
+        for (ReaderRecord* r = readers.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            bool expected = false;
+            if (!r->inUse.load(std::memory_order_relaxed) && r->inUse.compare_exchange_strong(expected, true)) {
+                return r;
+            }
+        }
+        ReaderRecord* record = new ReaderRecord;
+        ReaderRecord* head = readers.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!readers.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+        return record;
+    }
+
+    struct RecordHolder {
+        ReaderRecord* record = acquireRecord();
+        ~RecordHolder() {
+            record->epoch.store(kQuiescent, std::memory_order_release);
+            record->inUse.store(false, std::memory_order_release);
+        }
+    };
+
+    // Oldest epoch any reader may still be inside, or UINT64_MAX if none is.
+    uint64_t oldestActiveEpoch() {
+        uint64_t oldest = UINT64_MAX;
+        for (ReaderRecord* r = readers.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            uint64_t e = r->epoch.load(std::memory_order_seq_cst);
+            if (e != kQuiescent && e < oldest) {
+                oldest = e;
+            }
+        }
+        return oldest;
+    }
+
+    // Frees every retiree no reader can still reference.
+    void reclaim(Retired* added) {
+        std::vector<Retired> ready;
+        {
+            std::lock_guard<std::mutex> guard(retiredMutex);
+            if (added != nullptr) {
+                retired.push_back(*added);
+                // Published before the scan, so a reader that leaves after
+                // the scan sees it and reclaims in our place
+                retiredCount.store(retired.size(), std::memory_order_seq_cst);
+            }
+
+            uint64_t oldest = oldestActiveEpoch();
+            auto keep = retired.begin();
+            for (auto it = retired.begin(); it != retired.end(); ++it) {
+                if (it->epoch < oldest) {
+                    ready.push_back(*it);
+                } else {
+                    *keep++ = *it;
+                }
+            }
+            retired.erase(keep, retired.end());
+            retiredCount.store(retired.size(), std::memory_order_seq_cst);
+        }
+
+        for (const Retired& r : ready) {
+            r.deleter(r.object);
+        }
+    }
+}
+
+namespace epochdetail {
+    ReaderRecord& localRecord() {
+        thread_local RecordHolder holder;
+        return *holder.record;
+    }
+
+    void enter(ReaderRecord& record) {
+        if (record.depth++ == 0) {
+            // seq_cst so the announcement is visible before we load any pointer
+            // a writer may be about to retire.
+            record.epoch.store(globalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+    }
+
+    // A reader that was inside when something was retired may be the last
+    // one holding it up, so it tries to free it on the way out rather than
+    // leaving it for the next retire(), which on a quiet server may not come.
+    void leave(ReaderRecord& record) {
+        if (--record.depth == 0) {
+            record.epoch.store(kQuiescent, std::memory_order_seq_cst);
+            if (retiredCount.load(std::memory_order_seq_cst) != 0) {
+                reclaim(nullptr);
+            }
+        }
+    }
+}
+
+void retireObject(void* object, void (*deleter)(void*)) {
+    // Readers that entered at or before this epoch may hold the object; any
+    // reader entering later loads the already-published replacement.
+    Retired added = { globalEpoch.fetch_add(1, std::memory_order_seq_cst), object, deleter };
+    reclaim(&added);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Epoch-based reclamation for read-mostly shared structures. Readers wrap
+// their access in an EpochGuard, which costs two uncontended stores to a
+// per-thread slot. Writers publish a replacement with an atomic pointer swap
+// and hand the old object to retire(); it is deleted only once every reader
+// that could still be looking at it has left its critical section.
+
+namespace epochdetail {
+    struct ReaderRecord;
+    ReaderRecord& localRecord();
+    void enter(ReaderRecord& record);
+    void leave(ReaderRecord& record);
+}
+
+class EpochGuard {
+public:
+    EpochGuard() : record(epochdetail::localRecord()) {
+        epochdetail::enter(record);
+    }
+    ~EpochGuard() {
+        epochdetail::leave(record);
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+private:
+    epochdetail::ReaderRecord& record;
+};
+
+// Schedules deleter(object) to run once no reader can still reference it.
+// Safe to call from any thread; also opportunistically frees earlier retirees.
+void retireObject(void* object, void (*deleter)(void*));
+
+template <typename T>
+void retire(const T* object) {
+    retireObject(const_cast<T*>(object), [](void* p) { delete static_cast<T*>(p); });
+}
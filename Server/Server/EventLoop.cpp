@@ -0,0 +1,542 @@
+#include "EventLoop.h"
+#include "Logger.h"
+
+
+#ifndef _WIN32
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "IoRing.h"
+#endif
+
+namespace {
+    const int kMaxEvents = 256;
+
+#ifndef _WIN32
+    // Submission ring size; the completion ring is twice as large.
+    const unsigned kRingEntries = 4096;
+
+    // Provided buffers shared by every multishot receive on a loop. A buffer
+    // is handed back as soon as its data has been parsed, so only a burst of
+    // completions in one batch needs more than a few of them.
+    const uint16_t kBufferGroup = 0;
+    const unsigned kRecvBufferCount = 256;
+    const unsigned kRecvBufferSize = 16 * 1024;
+
+    // user_data of a ring operation is its slot pointer tagged with the kind
+    // of operation in the low bits; the wakeup poll uses 0, and the timer
+    // tick a null slot with the cancel tag.
+    const uint64_t kWakeData = 0;
+    const uint64_t kTagRecv = 0;
+    const uint64_t kTagSend = 1;
+    const uint64_t kTagAccept = 2;
+    const uint64_t kTagCancel = 3;
+    const uint64_t kTagMask = 3;
+    const uint64_t kTickData = kTagCancel;
+#endif
+}
+
+bool parseIoBackend(std::string_view name, IoBackend& backend) {
+    if (name == "poll") backend = IoBackend::Poll;
+#ifndef _WIN32
+    else if (name == "uring") backend = IoBackend::IoUring;
+#endif
+    else return false;
+    return true;
+}
+
+#ifdef _WIN32
+
+EventLoop::EventLoop(IoBackend, size_t index)
+    : loopIndex(index) {
+    // Winsock has no eventfd; a connected loopback UDP pair wakes WSAPoll instead.
+    wakeRecv = socket(AF_INET, SOCK_DGRAM, 0);
+    wakeSend = socket(AF_INET, SOCK_DGRAM, 0);
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int addrSize = sizeof(addr);
+    if (bind(wakeRecv, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(wakeRecv, (sockaddr*)&addr, &addrSize) == SOCKET_ERROR ||
+        connect(wakeSend, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        logError("Failed to create event loop wakeup socket. Error: ", lastSocketError());
+    }
+    setNonBlocking(wakeRecv);
+
+    pollFds.push_back({ wakeRecv, POLLRDNORM, 0 });
+    handlers.push_back(nullptr);
+}
+
+EventLoop::~EventLoop() {
+    closesocket(wakeRecv);
+    closesocket(wakeSend);
+}
+
+IoBackend EventLoop::backend() const {
+    return IoBackend::Poll;
+}
+
+size_t EventLoop::findSlot(SOCKET s) const {
+    for (size_t i = 1; i < pollFds.size(); ++i) {
+        if (pollFds[i].fd == s) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+bool EventLoop::add(SOCKET s, IoHandler* handler) {
+    pollFds.push_back({ s, POLLRDNORM, 0 });
+    handlers.push_back(handler);
+    return true;
+}
+
+bool EventLoop::addListener(SOCKET s, IoHandler* handler) {
+    return add(s, handler);
+}
+
+bool EventLoop::submitSend(SOCKET, IoHandler*, std::vector<SharedFrame>&, size_t) {
+    return false;
+}
+
+void EventLoop::remove(SOCKET s) {
+    size_t slot = findSlot(s);
+    if (slot == 0) {
+        return;
+    }
+    // Swap-remove; run() walks the arrays backwards so this is safe mid-dispatch.
+    pollFds[slot] = pollFds.back();
+    handlers[slot] = handlers.back();
+    pollFds.pop_back();
+    handlers.pop_back();
+}
+
+void EventLoop::setWriteInterest(SOCKET s, IoHandler*, bool enabled) {
+    size_t slot = findSlot(s);
+    if (slot != 0) {
+        pollFds[slot].events = enabled ? (POLLRDNORM | POLLWRNORM) : POLLRDNORM;
+    }
+}
+
+void EventLoop::wake() {
+    char byte = 0;
+    send(wakeSend, &byte, 1, 0);
+}
+
+void EventLoop::run() {
+    running = true;
+    while (running) {
+        int ready = WSAPoll(pollFds.data(), (ULONG)pollFds.size(), timerWheel.waitMs(TimerWheel::nowMs()));
+        if (ready == SOCKET_ERROR) {
+            logError("WSAPoll failed. Error: ", WSAGetLastError());
+            continue;
+        }
+
+        if (pollFds[0].revents != 0) {
+            char drain[64];
+            while (recv(wakeRecv, drain, sizeof(drain), 0) > 0) {
+            }
+        }
+
+        for (size_t i = pollFds.size() - 1; i > 0; --i) {
+            if (i >= pollFds.size()) {
+                continue;
+            }
+            short revents = pollFds[i].revents;
+            pollFds[i].revents = 0;
+            if (revents == 0) {
+                continue;
+            }
+            IoHandler* handler = handlers[i];
+            if (revents & (POLLRDNORM | POLLHUP | POLLERR)) {
+                handler->onReadable();
+            }
+            if ((revents & POLLWRNORM) && i < handlers.size() && handlers[i] == handler) {
+                handler->onWritable();
+            }
+        }
+
+        runPending();
+        timerWheel.advance(TimerWheel::nowMs());
+    }
+}
+
+#else
+
+// One socket registered with an io_uring loop. Completions can still arrive
+// after remove(), so the slot outlives its registration until every operation
+// on it has completed; handler is cleared on removal so those are dropped.
+struct EventLoop::UringSlot {
+    SOCKET fd;
+    IoHandler* handler;
+    bool listener = false;
+    unsigned inFlight = 0;
+    // The in-flight send; the kernel may read all of it until it completes.
+    std::vector<SharedFrame> sending;
+    std::vector<IoBuffer> buffers;
+    msghdr message;
+};
+
+EventLoop::EventLoop(IoBackend requested, size_t index)
+    : loopIndex(index) {
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd == -1) {
+        logError("Failed to create event loop. Error: ", errno);
+        return;
+    }
+
+    if (requested == IoBackend::IoUring) {
+        ring = std::make_unique<IoRing>();
+        if (ring->init(kRingEntries) && ring->setupBuffers(kBufferGroup, kRecvBufferCount, kRecvBufferSize)) {
+            armWake();
+            return;
+        }
+        logWarn("io_uring is unavailable (error ", errno, "), falling back to epoll.");
+        ring.reset();
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+        logError("Failed to create event loop. Error: ", errno);
+        return;
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+}
+
+EventLoop::~EventLoop() {
+    ring.reset();
+    for (auto& entry : slots) {
+        delete entry.second;
+    }
+    close(wakeFd);
+    if (epollFd != -1) {
+        close(epollFd);
+    }
+}
+
+IoBackend EventLoop::backend() const {
+    return ring ? IoBackend::IoUring : IoBackend::Poll;
+}
+
+bool EventLoop::add(SOCKET s, IoHandler* handler) {
+    if (ring) {
+        return armReceive(newSlot(s, handler));
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = handler;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, s, &ev) == 0;
+}
+
+bool EventLoop::addListener(SOCKET s, IoHandler* handler) {
+    if (ring) {
+        UringSlot* slot = newSlot(s, handler);
+        slot->listener = true;
+        return armAccept(slot);
+    }
+    return add(s, handler);
+}
+
+void EventLoop::remove(SOCKET s) {
+    if (!ring) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, s, nullptr);
+        return;
+    }
+
+    auto it = slots.find(s);
+    if (it == slots.end()) {
+        return;
+    }
+    UringSlot* slot = it->second;
+    slots.erase(it);
+    slot->handler = nullptr;
+    if (slot->inFlight == 0) {
+        delete slot;
+        return;
+    }
+
+    // Stop the multishot operation; an in-flight send just runs to completion.
+    if (io_uring_sqe* sqe = ring->getSqe()) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t)slot | (slot->listener ? kTagAccept : kTagRecv);
+        sqe->user_data = (uint64_t)(uintptr_t)slot | kTagCancel;
+    }
+}
+
+void EventLoop::setWriteInterest(SOCKET s, IoHandler* handler, bool enabled) {
+    if (ring) {
+        return;
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP | (enabled ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.ptr = handler;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, s, &ev);
+}
+
+bool EventLoop::submitSend(SOCKET s, IoHandler* handler, std::vector<SharedFrame>& frames, size_t offset) {
+    auto it = slots.find(s);
+    if (!ring || it == slots.end() || it->second->handler != handler || frames.empty()) {
+        return false;
+    }
+    io_uring_sqe* sqe = ring->getSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    UringSlot* slot = it->second;
+    slot->sending.swap(frames);
+    slot->buffers.resize(slot->sending.size());
+    for (size_t i = 0; i < slot->sending.size(); ++i) {
+        const SharedFrame& frame = slot->sending[i];
+        setIoBuffer(slot->buffers[i], frame.data() + offset, frame.size() - offset);
+        offset = 0;
+    }
+    slot->message = msghdr();
+    slot->message.msg_iov = slot->buffers.data();
+    slot->message.msg_iovlen = slot->buffers.size();
+    slot->inFlight++;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = s;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->message;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)slot | kTagSend;
+    return true;
+}
+
+void EventLoop::wake() {
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd, &one, sizeof(one));
+    (void)written;
+}
+
+EventLoop::UringSlot* EventLoop::newSlot(SOCKET s, IoHandler* handler) {
+    UringSlot* slot = new UringSlot();
+    slot->fd = s;
+    slot->handler = handler;
+    slots[s] = slot;
+    return slot;
+}
+
+// Without the wake poll a blocking wait would sleep through posted tasks, so
+// a full submission queue leaves it for runUring() to retry.
+bool EventLoop::armWake() {
+    io_uring_sqe* sqe = ring->getSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakeFd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = kWakeData;
+    wakeArmed = true;
+    return true;
+}
+
+// One relative timeout per tick while any timer is armed, so the loop wakes
+// for expiries without an I/O completion.
+void EventLoop::armTick() {
+    io_uring_sqe* sqe = ring->getSqe();
+    if (sqe == nullptr) {
+        return;
+    }
+    int waitMs = timerWheel.waitMs(TimerWheel::nowMs());
+    tickTimeout.tv_sec = 0;
+    tickTimeout.tv_nsec = (long long)waitMs * 1000000;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&tickTimeout;
+    sqe->len = 1;
+    sqe->user_data = kTickData;
+    tickArmed = true;
+}
+
+bool EventLoop::armReceive(UringSlot* slot) {
+    io_uring_sqe* sqe = ring->getSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = slot->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = (uint64_t)(uintptr_t)slot | kTagRecv;
+    slot->inFlight++;
+    return true;
+}
+
+bool EventLoop::armAccept(UringSlot* slot) {
+    io_uring_sqe* sqe = ring->getSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = slot->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = (uint64_t)(uintptr_t)slot | kTagAccept;
+    slot->inFlight++;
+    return true;
+}
+
+void EventLoop::handleCompletion(const io_uring_cqe& cqe) {
+    if (cqe.user_data == kWakeData) {
+        uint64_t count;
+        ssize_t drained = read(wakeFd, &count, sizeof(count));
+        (void)drained;
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            wakeArmed = false;
+            armWake();
+        }
+        return;
+    }
+    if (cqe.user_data == kTickData) {
+        tickArmed = false;
+        return;
+    }
+
+    uint64_t tag = cqe.user_data & kTagMask;
+    if (tag == kTagCancel) {
+        return;
+    }
+    UringSlot* slot = (UringSlot*)(uintptr_t)(cqe.user_data & ~kTagMask);
+    bool finished = tag == kTagSend || !(cqe.flags & IORING_CQE_F_MORE);
+
+    switch (tag) {
+    case kTagRecv:
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t id = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (slot->handler) {
+                slot->handler->onReceived(ring->buffer(id), cqe.res);
+            }
+            ring->recycleBuffer(id);
+        } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED && slot->handler) {
+            slot->handler->onReceived(nullptr, cqe.res);
+        }
+        // A multishot receive also ends when the buffers briefly run out
+        if (finished && slot->handler && (cqe.res > 0 || cqe.res == -ENOBUFS)) {
+            armReceive(slot);
+        }
+        break;
+
+    case kTagSend:
+        slot->sending.clear();
+        if (slot->handler) {
+            slot->handler->onSent(cqe.res);
+        }
+        break;
+
+    case kTagAccept:
+        if (cqe.res >= 0) {
+            if (slot->handler) {
+                slot->handler->onAccepted((SOCKET)cqe.res);
+            } else {
+                closesocket((SOCKET)cqe.res);
+            }
+        } else if (cqe.res != -ECANCELED) {
+            logError("Accept failed. Error: ", -cqe.res);
+        }
+        if (finished && slot->handler) {
+            armAccept(slot);
+        }
+        break;
+    }
+
+    if (finished && --slot->inFlight == 0 && slot->handler == nullptr) {
+        delete slot;
+    }
+}
+
+void EventLoop::runUring() {
+    while (running) {
+        if (!wakeArmed) {
+            armWake();
+        }
+        // Until the wake poll is back, poll the ring instead of blocking on it
+        int result = ring->submitAndWait(wakeArmed ? 1 : 0);
+        if (result < 0 && result != -EBUSY && result != -EAGAIN) {
+            logError("io_uring_enter failed. Error: ", -result);
+        }
+        ring->reap([this](const io_uring_cqe& cqe) { handleCompletion(cqe); });
+        runPending();
+        timerWheel.advance(TimerWheel::nowMs());
+        if (!tickArmed && !timerWheel.empty()) {
+            armTick();
+        }
+    }
+}
+
+void EventLoop::run() {
+    running = true;
+    if (ring) {
+        runUring();
+        return;
+    }
+
+    epoll_event events[kMaxEvents];
+    while (running) {
+        int ready = epoll_wait(epollFd, events, kMaxEvents, timerWheel.waitMs(TimerWheel::nowMs()));
+        if (ready == -1) {
+            if (errno != EINTR) {
+                logError("epoll_wait failed. Error: ", errno);
+            }
+            continue;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            IoHandler* handler = static_cast<IoHandler*>(events[i].data.ptr);
+            if (handler == nullptr) {
+                uint64_t count;
+                ssize_t drained = read(wakeFd, &count, sizeof(count));
+                (void)drained;
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                handler->onReadable();
+            }
+            if (events[i].events & EPOLLOUT) {
+                handler->onWritable();
+            }
+        }
+
+        runPending();
+        timerWheel.advance(TimerWheel::nowMs());
+    }
+}
+
+#endif
+
+void EventLoop::post(Task task) {
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> guard(pendingMutex);
+        wasEmpty = pending.empty();
+        pending.push_back(std::move(task));
+    }
+    if (wasEmpty) {
+        wake();
+    }
+}
+
+void EventLoop::runPending() {
+    {
+        std::lock_guard<std::mutex> guard(pendingMutex);
+        runningTasks.swap(pending);
+    }
+    for (Task& task : runningTasks) {
+        task();
+    }
+    runningTasks.clear();
+}
+
+void EventLoop::stop() {
+    running = false;
+    wake();
+}
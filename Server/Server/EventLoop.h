@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+#include "Net.h"
+#include "SharedFrame.h"
+#include "TimerWheel.h"
+
+#ifndef _WIN32
+#include <linux/time_types.h>
+#endif
+
+class IoRing;
+struct io_uring_cqe;
+
+// How a loop waits for I/O. IoUring is Linux-only and falls back to Poll if
+// the kernel refuses to set up a ring.
+enum class IoBackend {
+    Poll,       // readiness: epoll on Linux, WSAPoll on Windows
+    IoUring,    // completions: multishot accept/recv, batched send submissions
+};
+
+bool parseIoBackend(std::string_view name, IoBackend& backend);
+
+// A unit of work posted to a loop. Like std::function<void()>, except the
+// callable is always stored inline, so posting never allocates; a lambda
+// capturing more than kCapacity bytes does not compile.
+class Task {
+public:
+    static const size_t kCapacity = 48;
+
+    Task() = default;
+
+    template <typename Fn, typename = std::enable_if_t<!std::is_same<std::decay_t<Fn>, Task>::value>>
+    Task(Fn&& fn) {
+        typedef std::decay_t<Fn> Callable;
+        static_assert(sizeof(Callable) <= kCapacity, "Task captures too much; capture a pointer instead");
+        static_assert(alignof(Callable) <= alignof(std::max_align_t), "Task callable is over-aligned");
+        new (storage) Callable(std::forward<Fn>(fn));
+        ops = &kOps<Callable>;
+    }
+
+    Task(Task&& other) noexcept {
+        take(other);
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    ~Task() { reset(); }
+
+    void operator()() { ops->invoke(storage); }
+
+private:
+    struct Ops {
+        void (*invoke)(void* callable);
+        void (*moveTo)(void* from, void* to);   // also destroys from
+        void (*destroy)(void* callable);
+    };
+
+    template <typename Callable>
+    static constexpr Ops kOps = {
+        [](void* callable) { (*static_cast<Callable*>(callable))(); },
+        [](void* from, void* to) {
+            new (to) Callable(std::move(*static_cast<Callable*>(from)));
+            static_cast<Callable*>(from)->~Callable();
+        },
+        [](void* callable) { static_cast<Callable*>(callable)->~Callable(); },
+    };
+
+    void take(Task& other) {
+        ops = other.ops;
+        if (ops != nullptr) {
+            ops->moveTo(other.storage, storage);
+            other.ops = nullptr;
+        }
+    }
+
+    void reset() {
+        if (ops != nullptr) {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage[kCapacity];
+    const Ops* ops = nullptr;
+};
+
+// Receives notifications for a socket registered with an EventLoop.
+// Callbacks always run on the loop's own thread. Readiness loops call
+// onReadable/onWritable; completion loops report results through the on*ed
+// callbacks, where a result is a byte count, 0 at end of stream, or -errno.
+class IoHandler {
+public:
+    virtual ~IoHandler() = default;
+    virtual void onReadable() = 0;
+    virtual void onWritable() {}
+    virtual void onReceived(const char* data, int result) { (void)data; (void)result; }
+    virtual void onSent(int result) { (void)result; }
+    virtual void onAccepted(SOCKET client) { (void)client; }
+    // A Timer this handler armed on the loop's wheel came due.
+    virtual void onTimer() {}
+};
+
+// Single-threaded reactor. A loop owns the sockets registered with it; add,
+// remove, setWriteInterest and submitSend must be called on the loop thread,
+// other threads hand work over via post().
+class EventLoop {
+public:
+    explicit EventLoop(IoBackend requested = IoBackend::Poll, size_t index = 0);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Position of the loop among the server's shards.
+    size_t index() const { return loopIndex; }
+    IoBackend backend() const;
+    bool completionBased() const { return backend() == IoBackend::IoUring; }
+
+    // Starts delivering a connected socket's input: onReadable for readiness
+    // loops, onReceived from a multishot receive for completion loops.
+    bool add(SOCKET s, IoHandler* handler);
+    // Starts delivering a listening socket: onReadable, or onAccepted for
+    // every connection from a multishot accept.
+    bool addListener(SOCKET s, IoHandler* handler);
+    void remove(SOCKET s);
+    // Readiness loops only.
+    void setWriteInterest(SOCKET s, IoHandler* handler, bool enabled);
+    // Completion loops only: queues one gathered send of the frames, the
+    // first starting at offset, reported through onSent. The loop takes the
+    // frames (leaving frames empty) and keeps them alive until the send
+    // completes. Sends queued in one loop iteration go to the kernel in one
+    // submission.
+    bool submitSend(SOCKET s, IoHandler* handler, std::vector<SharedFrame>& frames, size_t offset);
+
+    // The loop's timers; loop thread only. Expiries fire through onTimer.
+    TimerWheel& timers() { return timerWheel; }
+
+    // Queues a task to run on the loop thread. Safe to call from any thread.
+    void post(Task task);
+
+    void run();
+    void stop();
+
+private:
+    void wake();
+    void runPending();
+
+#ifdef _WIN32
+    size_t findSlot(SOCKET s) const;
+
+    std::vector<WSAPOLLFD> pollFds;     // slot 0 is the wakeup socket
+    std::vector<IoHandler*> handlers;   // parallel to pollFds
+    SOCKET wakeRecv = INVALID_SOCKET;
+    SOCKET wakeSend = INVALID_SOCKET;
+#else
+    struct UringSlot;
+
+    void runUring();
+    void handleCompletion(const io_uring_cqe& cqe);
+    bool armWake();
+    void armTick();
+    bool armReceive(UringSlot* slot);
+    bool armAccept(UringSlot* slot);
+    UringSlot* newSlot(SOCKET s, IoHandler* handler);
+
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::unique_ptr<IoRing> ring;                   // set when using io_uring
+    std::unordered_map<SOCKET, UringSlot*> slots;   // io_uring registrations
+    __kernel_timespec tickTimeout = {};
+    bool tickArmed = false;
+    bool wakeArmed = false;
+#endif
+
+    size_t loopIndex;
+    TimerWheel timerWheel;
+    std::mutex pendingMutex;
+    std::vector<Task> pending;
+    std::vector<Task> runningTasks;     // loop thread; swapped with pending to keep both capacities
+    std::atomic<bool> running{ false };
+};
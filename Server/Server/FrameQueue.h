@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include "BufferPool.h"
+#include "SharedFrame.h"
+
+// FIFO of frames in a ring that doubles as needed. Unlike std::deque, pushing
+// and popping in steady state never allocates; the ring's storage comes from
+// the buffer pool and is handed back once the queue drains, so idle
+// connections hold none.
+class FrameQueue {
+public:
+    FrameQueue() = default;
+    ~FrameQueue() { clear(); }
+
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // i counts from the front.
+    SharedFrame& operator[](size_t i) { return slots[(head + i) & (capacity - 1)]; }
+    const SharedFrame& operator[](size_t i) const { return slots[(head + i) & (capacity - 1)]; }
+    SharedFrame& front() { return (*this)[0]; }
+    SharedFrame& back() { return (*this)[count - 1]; }
+
+    void push_back(const SharedFrame& frame) {
+        if (count == capacity) {
+            grow();
+        }
+        new (&slots[(head + count) & (capacity - 1)]) SharedFrame(frame);
+        ++count;
+    }
+
+    void pop_front() {
+        front().~SharedFrame();
+        head = (head + 1) & (capacity - 1);
+        if (--count == 0) {
+            release();
+        }
+    }
+
+    void pop_back() {
+        back().~SharedFrame();
+        if (--count == 0) {
+            release();
+        }
+    }
+
+    // Removes the i-th frame, shifting the ones before it back by one.
+    void erase(size_t i) {
+        for (; i > 0; --i) {
+            (*this)[i] = std::move((*this)[i - 1]);
+        }
+        pop_front();
+    }
+
+    // Inserts a frame before the i-th one, shifting the ones from there on
+    // back by one.
+    void insert(size_t i, const SharedFrame& frame) {
+        push_back(frame);
+        for (size_t j = count - 1; j > i; --j) {
+            std::swap((*this)[j], (*this)[j - 1]);
+        }
+    }
+
+    void clear() {
+        while (count != 0) {
+            pop_back();
+        }
+    }
+
+private:
+    static const size_t kInitialCapacity = 8;
+
+    void grow() {
+        size_t newCapacity = capacity == 0 ? kInitialCapacity : capacity * 2;
+        SharedFrame* newSlots = static_cast<SharedFrame*>(poolAllocate(newCapacity * sizeof(SharedFrame)));
+        for (size_t i = 0; i < count; ++i) {
+            new (&newSlots[i]) SharedFrame(std::move((*this)[i]));
+            (*this)[i].~SharedFrame();
+        }
+        poolRelease(slots);
+        slots = newSlots;
+        capacity = newCapacity;
+        head = 0;
+    }
+
+    void release() {
+        poolRelease(slots);
+        slots = nullptr;
+        capacity = 0;
+        head = 0;
+    }
+
+    SharedFrame* slots = nullptr;
+    size_t capacity = 0;    // zero or a power of two
+    size_t head = 0;
+    size_t count = 0;
+};
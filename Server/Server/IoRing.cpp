@@ -0,0 +1,170 @@
+#include "IoRing.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    int ioUringSetup(unsigned entries, io_uring_params* params) {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+        return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+    }
+
+    template <typename T>
+    T* at(void* base, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+}
+
+IoRing::~IoRing() {
+    if (bufRing != nullptr) {
+        munmap(bufRing, bufRingSize);
+    }
+    if (sqes != nullptr) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqMap != nullptr && cqMap != sqMap) {
+        munmap(cqMap, cqMapSize);
+    }
+    if (sqMap != nullptr) {
+        munmap(sqMap, sqMapSize);
+    }
+    if (ringFd != -1) {
+        close(ringFd);
+    }
+}
+
+bool IoRing::init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Completions are only reaped between loop iterations anyway, so the
+    // kernel need not interrupt the thread to run completion work.
+    params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+    ringFd = ioUringSetup(entries, &params);
+    if (ringFd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        ringFd = ioUringSetup(entries, &params);
+    }
+    if (ringFd < 0) {
+        return false;
+    }
+
+    sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+    }
+
+    sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED) {
+        sqMap = nullptr;
+        return false;
+    }
+    cqMap = singleMap ? sqMap : mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqMap == MAP_FAILED) {
+        cqMap = nullptr;
+        return false;
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqeMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqeMap == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqeMap);
+
+    sqHead = at<unsigned>(sqMap, params.sq_off.head);
+    sqTail = at<unsigned>(sqMap, params.sq_off.tail);
+    sqMask = at<unsigned>(sqMap, params.sq_off.ring_mask);
+    sqArray = at<unsigned>(sqMap, params.sq_off.array);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+
+    cqHead = at<unsigned>(cqMap, params.cq_off.head);
+    cqTail = at<unsigned>(cqMap, params.cq_off.tail);
+    cqMask = at<unsigned>(cqMap, params.cq_off.ring_mask);
+    cqes = at<io_uring_cqe>(cqMap, params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* IoRing::getSqe() {
+    if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        submitAndWait(0);
+        if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            return nullptr;
+        }
+    }
+    unsigned index = sqLocalTail & *sqMask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    ++sqLocalTail;
+    ++toSubmit;
+    return sqe;
+}
+
+int IoRing::submitAndWait(unsigned waitFor) {
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    while (true) {
+        int result = ioUringEnter(ringFd, toSubmit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (result >= 0) {
+            toSubmit -= std::min((unsigned)result, toSubmit);
+            return result;
+        }
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+bool IoRing::setupBuffers(uint16_t group, unsigned count, unsigned size) {
+    bufRingSize = count * sizeof(io_uring_buf);
+    void* ringMemory = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ringMemory == MAP_FAILED) {
+        return false;
+    }
+    bufRing = static_cast<io_uring_buf_ring*>(ringMemory);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)bufRing;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return false;
+    }
+
+    bufRingMask = count - 1;
+    bufferSize = size;
+    bufferMemory.resize((size_t)count * size);
+    for (unsigned id = 0; id < count; ++id) {
+        recycleBuffer((uint16_t)id);
+    }
+    return true;
+}
+
+void IoRing::recycleBuffer(uint16_t id) {
+    // Only addr, len and bid are written: the ring's tail overlays bufs[0].resv.
+    // The entries are indexed by hand because in C++ the header's flexible
+    // array sits behind a one-byte empty struct, not at offset 0 as in C.
+    uint16_t tail = bufRing->tail;
+    io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(bufRing)[tail & bufRingMask];
+    buf.addr = (uint64_t)(uintptr_t)buffer(id);
+    buf.len = bufferSize;
+    buf.bid = id;
+    __atomic_store_n(&bufRing->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <linux/io_uring.h>
+
+// Thin wrapper over a raw io_uring instance (no liburing): maps the
+// submission and completion rings, hands out SQEs and reaps CQEs, and owns one
+// provided-buffer ring that multishot receives pick their buffers from.
+// Not thread-safe; an EventLoop owns one and uses it from its own thread.
+class IoRing {
+public:
+    IoRing() = default;
+    ~IoRing();
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // Creates the ring. Returns false (with errno set) if io_uring is unavailable.
+    bool init(unsigned entries);
+
+    // Returns a zeroed SQE, submitting queued ones first if the ring is full.
+    io_uring_sqe* getSqe();
+
+    // Submits queued SQEs and waits for at least waitFor completions.
+    int submitAndWait(unsigned waitFor);
+
+    // Calls fn(const io_uring_cqe&) for every available completion.
+    template <typename Fn>
+    unsigned reap(Fn fn) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned seen = 0;
+        for (; head != tail; ++head, ++seen) {
+            fn(cqes[head & *cqMask]);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return seen;
+    }
+
+    // Registers count buffers of size bytes as provided-buffer group `group`.
+    bool setupBuffers(uint16_t group, unsigned count, unsigned size);
+    const char* buffer(uint16_t id) const { return bufferMemory.data() + (size_t)id * bufferSize; }
+    // Hands a buffer the kernel filled back to the ring.
+    void recycleBuffer(uint16_t id);
+
+private:
+    int ringFd = -1;
+
+    void* sqMap = nullptr;
+    size_t sqMapSize = 0;
+    void* cqMap = nullptr;
+    size_t cqMapSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqEntries = 0;
+    unsigned sqLocalTail = 0;   // SQEs handed out but not yet published
+    unsigned toSubmit = 0;
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    io_uring_buf_ring* bufRing = nullptr;
+    size_t bufRingSize = 0;
+    unsigned bufRingMask = 0;
+    unsigned bufferSize = 0;
+    std::vector<char> bufferMemory;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include "Logger.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+namespace logdetail {
+    std::atomic<LogLevel> minLevel{ LogLevel::Info };
+}
+
+namespace {
+    using logdetail::Slot;
+
+    const size_t kCapacity = 8192;  // power of two
+    const size_t kMask = kCapacity - 1;
+
+    // Bounded multi-producer queue (Vyukov): each slot's sequence number says
+    // whether it is free for the producer at that position or ready for the
+    // consumer, so producers only contend on one fetch of enqueuePos.
+    Slot slots[kCapacity];
+    alignas(64) std::atomic<size_t> enqueuePos{ 0 };
+    alignas(64) size_t dequeuePos = 0;  // writer thread only
+    std::atomic<uint64_t> droppedLines{ 0 };
+
+    std::atomic<bool> running{ false };
+    std::thread writerThread;
+
+    struct SlotInit {
+        SlotInit() {
+            for (size_t i = 0; i < kCapacity; ++i) {
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+    } slotInit;
+
+    // Moves every published line into the two batches. Returns lines taken.
+    size_t drain(std::string& out, std::string& err) {
+        size_t taken = 0;
+        while (true) {
+            Slot& slot = slots[dequeuePos & kMask];
+            if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+                break;
+            }
+            std::string& batch = slot.level >= LogLevel::Warn ? err : out;
+            batch.append(slot.text, slot.length);
+            batch.push_back('\n');
+            slot.sequence.store(dequeuePos + kCapacity, std::memory_order_release);
+            ++dequeuePos;
+            ++taken;
+        }
+
+        uint64_t dropped = droppedLines.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            err += "Log buffer full, dropped " + std::to_string(dropped) + " lines.\n";
+        }
+        return taken;
+    }
+
+    void writeBatch(std::string& batch, FILE* stream) {
+        if (!batch.empty()) {
+            fwrite(batch.data(), 1, batch.size(), stream);
+            fflush(stream);
+            batch.clear();
+        }
+    }
+
+    void writerLoop() {
+        std::string out, err;
+        out.reserve(64 * 1024);
+        err.reserve(4 * 1024);
+
+        while (running.load(std::memory_order_acquire)) {
+            if (drain(out, err) == 0) {
+                // Idle: poll rather than have producers signal a condition
+                // variable, which would put a syscall back on their path.
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                continue;
+            }
+            writeBatch(err, stderr);
+            writeBatch(out, stdout);
+        }
+
+        drain(out, err);
+        writeBatch(err, stderr);
+        writeBatch(out, stdout);
+    }
+}
+
+namespace logdetail {
+    Slot* claimSlot() {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            Slot* slot = &slots[pos & kMask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return slot;
+                }
+            } else if (diff < 0) {
+                droppedLines.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void publishSlot(Slot* slot) {
+        size_t pos = slot->sequence.load(std::memory_order_relaxed);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+    }
+}
+
+bool parseLogLevel(std::string_view name, LogLevel& level) {
+    if (name == "debug") level = LogLevel::Debug;
+    else if (name == "info") level = LogLevel::Info;
+    else if (name == "warn") level = LogLevel::Warn;
+    else if (name == "error") level = LogLevel::Error;
+    else return false;
+    return true;
+}
+
+void startLogger(LogLevel minLevel) {
+    logdetail::minLevel = minLevel;
+    if (!running.exchange(true)) {
+        writerThread = std::thread(writerLoop);
+    }
+}
+
+void stopLogger() {
+    if (running.exchange(false)) {
+        writerThread.join();
+    }
+}
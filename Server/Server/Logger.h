@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Asynchronous logger. Callers format straight into a slot of a lock-free
+// ring buffer and return; a background thread drains the ring and writes
+// whole batches to stdout/stderr, so logging never takes the iostream lock or
+// flushes on the caller's thread. When the ring is full, lines are dropped
+// and counted instead of blocking.
+
+enum class LogLevel : uint8_t {
+    Debug,
+    Info,
+    Warn,
+    Error,
+};
+
+bool parseLogLevel(std::string_view name, LogLevel& level);
+
+void startLogger(LogLevel minLevel);
+void stopLogger();  // drains everything queued so far, then joins the writer
+
+namespace logdetail {
+    const size_t kTextSize = 240;
+
+    struct Slot {
+        std::atomic<size_t> sequence;
+        LogLevel level;
+        uint16_t length;
+        char text[kTextSize];
+    };
+
+    extern std::atomic<LogLevel> minLevel;
+
+    Slot* claimSlot();               // nullptr when the ring is full
+    void publishSlot(Slot* slot);
+
+    // Appends one argument to a fixed-size line, truncating on overflow.
+    class LineWriter {
+    public:
+        explicit LineWriter(char* out) : out(out) {}
+
+        void append(std::string_view text) {
+            size_t n = std::min(text.size(), kTextSize - length);
+            std::memcpy(out + length, text.data(), n);
+            length += n;
+        }
+        void append(const char* text) { append(std::string_view(text)); }
+        void append(const std::string& text) { append(std::string_view(text)); }
+        void append(char c) { append(std::string_view(&c, 1)); }
+
+        template <typename T, typename = std::enable_if_t<std::is_integral<T>::value>>
+        void append(T value) {
+            auto result = std::to_chars(out + length, out + kTextSize, value);
+            if (result.ec == std::errc()) {
+                length = result.ptr - out;
+            }
+        }
+
+        size_t size() const { return length; }
+
+    private:
+        char* out;
+        size_t length = 0;
+    };
+}
+
+inline bool logEnabled(LogLevel level) {
+    return level >= logdetail::minLevel.load(std::memory_order_relaxed);
+}
+
+// Concatenates the arguments (strings, characters, integers) into one line.
+template <typename... Args>
+void logMessage(LogLevel level, const Args&... args) {
+    if (!logEnabled(level)) {
+        return;
+    }
+    logdetail::Slot* slot = logdetail::claimSlot();
+    if (slot == nullptr) {
+        return;
+    }
+    logdetail::LineWriter writer(slot->text);
+    (writer.append(args), ...);
+    slot->level = level;
+    slot->length = (uint16_t)writer.size();
+    logdetail::publishSlot(slot);
+}
+
+template <typename... Args> void logDebug(const Args&... args) { logMessage(LogLevel::Debug, args...); }
+template <typename... Args> void logInfo(const Args&... args) { logMessage(LogLevel::Info, args...); }
+template <typename... Args> void logWarn(const Args&... args) { logMessage(LogLevel::Warn, args...); }
+template <typename... Args> void logError(const Args&... args) { logMessage(LogLevel::Error, args...); }
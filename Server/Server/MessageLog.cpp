@@ -0,0 +1,401 @@
+#include "MessageLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include "Connection.h"
+#include "Logger.h"
+#include "Protocol.h"
+#include "Users.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    const size_t kRecordHeaderSize = 16;
+    const uint64_t kSegmentBytes = 64ull * 1024 * 1024;
+
+    // How long the writer lets appends accumulate once the first arrives;
+    // everything that arrives in that window shares one fsync.
+    const auto kGroupCommitInterval = std::chrono::milliseconds(2);
+
+    // Rooms whose recent records stay indexed for replay.
+    const size_t kMaxIndexedRooms = 10000;
+
+    uint32_t crc32(const char* data, size_t length) {
+        static const struct Table {
+            uint32_t entries[256];
+            Table() {
+                for (uint32_t i = 0; i < 256; ++i) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    entries[i] = c;
+                }
+            }
+        } table;
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < length; ++i) {
+            crc = table.entries[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    bool syncFile(FILE* file) {
+        if (fflush(file) != 0) {
+            return false;
+        }
+#ifdef _WIN32
+        return _commit(_fileno(file)) == 0;
+#else
+        return fdatasync(fileno(file)) == 0;
+#endif
+    }
+
+    // Room a logged frame belongs to and its number there, from the start of
+    // its payload. Frames written under an older protocol version belong to
+    // none, so they are never replayed to clients that would misread them.
+    bool frameRoom(const char* frame, size_t length, std::string_view& room, uint64_t& roomSequence) {
+        if (length < kFrameHeaderSize || (uint8_t)frame[4] != kProtocolVersion) {
+            return false;
+        }
+        std::string_view text;
+        return splitSequencedPayload(std::string_view(frame + kFrameHeaderSize, length - kFrameHeaderSize), room, roomSequence, text);
+    }
+}
+
+MessageLog::MessageLog(std::string directory, size_t replayLimit, UserTable* users)
+    : directory(std::move(directory)), replayLimit(replayLimit), users(users) {
+}
+
+MessageLog::~MessageLog() {
+    close();
+}
+
+std::string MessageLog::segmentPath(uint64_t segment) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu.log", (unsigned long long)segment);
+    return (std::filesystem::path(directory) / name).string();
+}
+
+bool MessageLog::open() {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        logError("Cannot create message log directory '", directory, "': ", error.message());
+        return false;
+    }
+
+    std::vector<uint64_t> segments;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::string stem = entry.path().stem().string();
+        if (entry.path().extension() == ".log" && !stem.empty() && stem.find_first_not_of("0123456789") == std::string::npos) {
+            segments.push_back(std::stoull(stem));
+        }
+    }
+    std::sort(segments.begin(), segments.end());
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        if (!recoverSegment(segments[i], i + 1 == segments.size())) {
+            return false;
+        }
+    }
+
+    if (!openSegment(segments.empty() ? sequence : segments.back())) {
+        return false;
+    }
+    if (!users->open((std::filesystem::path(directory) / "users.dat").string())) {
+        return false;
+    }
+
+    logInfo("Message log '", directory, "' opened, next sequence ", sequence, ".");
+    running = true;
+    writer = std::thread(&MessageLog::writerLoop, this);
+    return true;
+}
+
+void MessageLog::close() {
+    {
+        std::lock_guard<std::mutex> guard(queueMutex);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    queueReady.notify_one();
+    writer.join();
+    if (segmentFile != nullptr) {
+        syncFile(segmentFile);
+        fclose(segmentFile);
+        segmentFile = nullptr;
+    }
+}
+
+// Rebuilds the replay index from one segment. A torn or corrupt tail on the
+// newest segment is what an interrupted write leaves behind and is cut off.
+bool MessageLog::recoverSegment(uint64_t segment, bool newest) {
+    std::string path = segmentPath(segment);
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        logError("Cannot open message log segment '", path, "'.");
+        return false;
+    }
+
+    uint64_t offset = 0;
+    char header[kRecordHeaderSize];
+    std::string frame;
+    while (in.read(header, kRecordHeaderSize)) {
+        uint32_t length = getUint32(header);
+        uint64_t recordSequence = getUint64(header + 4);
+        uint32_t checksum = getUint32(header + 12);
+        if (length > kFrameHeaderSize + kMaxFramePayload) {
+            break;
+        }
+        frame.resize(length);
+        if (!in.read(&frame[0], length) || crc32(frame.data(), length) != checksum) {
+            break;
+        }
+
+        std::string_view room;
+        uint64_t roomSequence;
+        if (frameRoom(frame.data(), length, room, roomSequence)) {
+            indexRecord(room, { recordSequence, roomSequence, segment, offset + kRecordHeaderSize, length });
+        }
+        sequence = std::max(sequence, recordSequence + 1);
+        offset += kRecordHeaderSize + length;
+    }
+
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(path, error);
+    if (!error && size != offset) {
+        if (!newest) {
+            logWarn("Message log segment '", path, "' is corrupt after byte ", offset, ".");
+        } else {
+            logWarn("Truncating torn tail of message log segment '", path, "' at byte ", offset, ".");
+            in.close();
+            std::filesystem::resize_file(path, offset, error);
+        }
+    }
+    return true;
+}
+
+bool MessageLog::openSegment(uint64_t firstSequence) {
+    if (segmentFile != nullptr) {
+        syncFile(segmentFile);
+        fclose(segmentFile);
+    }
+
+    std::string path = segmentPath(firstSequence);
+    segmentFile = fopen(path.c_str(), "ab");
+    if (segmentFile == nullptr) {
+        logError("Cannot open message log segment '", path, "' for writing.");
+        return false;
+    }
+
+    std::error_code error;
+    segmentId = firstSequence;
+    segmentSize = std::filesystem::file_size(path, error);
+    return true;
+}
+
+void MessageLog::indexRecord(std::string_view room, const Location& location) {
+    std::string name(room);
+    auto it = recent.find(name);
+    if (it == recent.end()) {
+        recentOrder.push_front(name);
+        it = recent.emplace(std::move(name), RoomIndex{ {}, recentOrder.begin() }).first;
+        if (recent.size() > kMaxIndexedRooms) {
+            recent.erase(recentOrder.back());
+            recentOrder.pop_back();
+        }
+    } else {
+        recentOrder.splice(recentOrder.begin(), recentOrder, it->second.order);
+    }
+    std::deque<Location>& locations = it->second.locations;
+    locations.push_back(location);
+    while (locations.size() > replayLimit) {
+        locations.pop_front();
+    }
+}
+
+uint64_t MessageLog::append(const SharedFrame& frame) {
+    uint64_t assigned;
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> guard(queueMutex);
+        assigned = sequence++;
+        wasEmpty = queue.empty();
+        queue.push_back({ assigned, frame, std::string(), nullptr, 0, 0 });
+    }
+    if (wasEmpty) {
+        queueReady.notify_one();
+    }
+    return assigned;
+}
+
+void MessageLog::replay(const std::string& room, std::shared_ptr<Connection> conn, uint64_t afterRoomSequence, uint64_t throughRoomSequence) {
+    if (replayLimit == 0) {
+        return;
+    }
+    conn->holdForCatchUp();
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> guard(queueMutex);
+        wasEmpty = queue.empty();
+        queue.push_back({ 0, SharedFrame(), room, std::move(conn), afterRoomSequence, throughRoomSequence });
+    }
+    if (wasEmpty) {
+        queueReady.notify_one();
+    }
+}
+
+// Sleeps until there is work, so an idle server never wakes it.
+void MessageLog::writerLoop() {
+    std::vector<Request> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueReady.wait(lock, [this]() { return !queue.empty() || !running; });
+            if (queue.empty()) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(kGroupCommitInterval);
+        {
+            std::lock_guard<std::mutex> guard(queueMutex);
+            batch.swap(queue);
+        }
+        // After the swap, so every ID the batch carries is already queued
+        users->writePending();
+        writeBatch(batch);
+        batch.clear();
+    }
+    users->writePending();
+}
+
+void MessageLog::writeBatch(std::vector<Request>& batch) {
+    std::string buffer;
+
+    auto flushBuffer = [&]() {
+        if (buffer.empty()) {
+            return;
+        }
+        if (fwrite(buffer.data(), 1, buffer.size(), segmentFile) != buffer.size() || !syncFile(segmentFile)) {
+            logError("Failed to write message log segment ", segmentId, "; ", buffer.size(), " bytes of messages are lost.");
+            discardTail();
+        } else {
+            segmentSize += buffer.size();
+        }
+        buffer.clear();
+    };
+
+    // Replays are resolved against the index in queue order, so each sees
+    // exactly the records appended before it, but are read back only once the
+    // batch is on disk.
+    std::vector<std::pair<const Request*, std::vector<Location>>> replays;
+
+    // A segment that cannot be opened loses the batch's remaining appends,
+    // but replays are still served; the next batch tries again
+    bool unwritable = false;
+    size_t skipped = 0;
+
+    for (const Request& request : batch) {
+        if (request.conn) {
+            replays.emplace_back(&request, replayLocations(request));
+            continue;
+        }
+        if (!unwritable && (segmentFile == nullptr || segmentSize + buffer.size() >= kSegmentBytes)) {
+            flushBuffer();
+            unwritable = !openSegment(request.sequence);
+        }
+        if (unwritable) {
+            ++skipped;
+            continue;
+        }
+
+        char header[kRecordHeaderSize];
+        uint32_t length = (uint32_t)request.frame.size();
+        putUint32(header, length);
+        putUint64(header + 4, request.sequence);
+        putUint32(header + 12, crc32(request.frame.data(), length));
+
+        std::string_view room;
+        uint64_t roomSequence;
+        if (frameRoom(request.frame.data(), length, room, roomSequence)) {
+            indexRecord(room, { request.sequence, roomSequence, segmentId, segmentSize + buffer.size() + kRecordHeaderSize, length });
+        }
+        buffer.append(header, kRecordHeaderSize);
+        buffer.append(request.frame.data(), length);
+    }
+    flushBuffer();
+    if (skipped != 0) {
+        logError("Dropped ", skipped, " messages that could not be written to the message log.");
+    }
+
+    for (const auto& replay : replays) {
+        serveReplay(*replay.first->conn, replay.second);
+    }
+}
+
+// After a failed write the segment may hold part of the buffer. Cut it back
+// to what was last written in full and forget the records indexed past that,
+// so replays never read them and later records start on a clean boundary.
+void MessageLog::discardTail() {
+    for (auto& entry : recent) {
+        std::deque<Location>& locations = entry.second.locations;
+        while (!locations.empty() && locations.back().segment == segmentId && locations.back().offset >= segmentSize) {
+            locations.pop_back();
+        }
+    }
+
+    fclose(segmentFile);
+    segmentFile = nullptr;
+    std::error_code error;
+    std::filesystem::resize_file(segmentPath(segmentId), segmentSize, error);
+    openSegment(segmentId);
+}
+
+std::vector<MessageLog::Location> MessageLog::replayLocations(const Request& request) const {
+    std::vector<Location> locations;
+    auto it = recent.find(request.room);
+    if (it != recent.end()) {
+        for (const Location& location : it->second.locations) {
+            if (location.roomSequence == 0 ? request.afterRoomSequence == 0
+                : location.roomSequence > request.afterRoomSequence && location.roomSequence <= request.throughRoomSequence) {
+                locations.push_back(location);
+            }
+        }
+    }
+    return locations;
+}
+
+// Always releases the hold replay() took, even if nothing could be read.
+void MessageLog::serveReplay(Connection& conn, const std::vector<Location>& locations) {
+    std::vector<SharedFrame> frames;
+    std::string frame;
+    for (const Location& location : locations) {
+        if (!readFrame(location, frame)) {
+            logWarn("Failed to read message ", location.sequence, " back from the message log.");
+            continue;
+        }
+        frames.push_back(SharedFrame::copyOf(frame.data(), frame.size()));
+    }
+    conn.finishCatchUp(frames.data(), frames.size());
+}
+
+bool MessageLog::readFrame(const Location& location, std::string& out) {
+    if (!reader.is_open() || readerSegment != location.segment) {
+        reader.close();
+        reader.open(segmentPath(location.segment), std::ios::binary);
+        readerSegment = location.segment;
+    }
+    reader.clear();
+    reader.seekg((std::streamoff)location.offset);
+    out.resize(location.length);
+    return (bool)reader.read(&out[0], location.length);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "SharedFrame.h"
+
+class Connection;
+class UserTable;
+
+// Append-only, segmented on-disk log of every broadcast frame.
+//
+// append() only queues a reference to the already-encoded frame; a writer
+// thread batches whatever has queued, writes it with one call and syncs it
+// with one fsync (group commit), so broadcasts never wait on the disk.
+// The same thread keeps the locations of the last few records per room and
+// serves replay() requests from disk, off the event loops. It also writes the
+// user table's new entries, ahead of the frames that carry their IDs.
+//
+// On disk each record is
+//   uint32 frame length | uint64 sequence | uint32 CRC-32 of frame | frame
+// in files named after the sequence of their first record. A torn record at
+// the end of the newest segment is truncated away on startup.
+class MessageLog {
+public:
+    MessageLog(std::string directory, size_t replayLimit, UserTable* users);
+    ~MessageLog();
+
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+
+    // Scans existing segments and opens the user table's file in the same
+    // directory, then starts the writer. False if the directory cannot be used.
+    bool open();
+    void close();
+
+    // Records a room-scoped frame. Returns its sequence number.
+    uint64_t append(const SharedFrame& frame);
+
+    // Catches the connection up on the room's records numbered above
+    // afterRoomSequence and up to throughRoomSequence, at most the last
+    // replayLimit of them, oldest first. The connection's sends are held from
+    // this call until they are queued, so they precede anything queued to it
+    // meanwhile. Unnumbered records are only replayed when afterRoomSequence
+    // is 0. Every record numbered up to throughRoomSequence must already have
+    // been appended.
+    void replay(const std::string& room, std::shared_ptr<Connection> conn, uint64_t afterRoomSequence, uint64_t throughRoomSequence);
+
+private:
+    struct Location {
+        uint64_t sequence;
+        uint64_t roomSequence;  // the room's number for the frame, 0 if none
+        uint64_t segment;   // first sequence of the segment file
+        uint64_t offset;    // of the frame bytes within the file
+        uint32_t length;
+    };
+
+    // A room's recent records. Rooms are kept in order of their last record
+    // and the least recent dropped past kMaxIndexedRooms, so rooms that were
+    // created and abandoned don't accumulate.
+    struct RoomIndex {
+        std::deque<Location> locations;
+        std::list<std::string>::iterator order;     // position in recentOrder
+    };
+
+    struct Request {
+        uint64_t sequence;
+        SharedFrame frame;                  // set for appends
+        std::string room;                   // set for replays
+        std::shared_ptr<Connection> conn;   // set for replays
+        uint64_t afterRoomSequence;         // set for replays
+        uint64_t throughRoomSequence;       // set for replays
+    };
+
+    bool recoverSegment(uint64_t segment, bool newest);
+    bool openSegment(uint64_t firstSequence);
+    void indexRecord(std::string_view room, const Location& location);
+    void writerLoop();
+    void writeBatch(std::vector<Request>& batch);
+    void discardTail();
+    std::vector<Location> replayLocations(const Request& request) const;
+    void serveReplay(Connection& conn, const std::vector<Location>& locations);
+    bool readFrame(const Location& location, std::string& out);
+    std::string segmentPath(uint64_t segment) const;
+
+    std::string directory;
+    size_t replayLimit;
+    UserTable* users;
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;     // signalled when the queue fills or the log closes
+    std::vector<Request> queue;     // guarded by queueMutex
+    uint64_t sequence = 1;          // guarded by queueMutex
+    bool running = false;           // guarded by queueMutex
+    std::thread writer;
+
+    // Writer thread only (and open() before it starts).
+    FILE* segmentFile = nullptr;
+    uint64_t segmentId = 0;
+    uint64_t segmentSize = 0;
+    std::unordered_map<std::string, RoomIndex> recent;
+    std::list<std::string> recentOrder;     // room names, most recently logged first
+    std::ifstream reader;
+    uint64_t readerSegment = 0;
+};
@@ -0,0 +1,246 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "Logger.h"
+#include "Net.h"
+
+namespace {
+    const size_t kMetricCount = (size_t)Metric::Count;
+    const size_t kCounterCount = (size_t)Counter::Count;
+
+    // One thread's histograms and counters. Only the owning thread writes, so
+    // a relaxed load and store replaces an atomic read-modify-write; readers
+    // see each counter either before or after an update.
+    struct ThreadHistograms {
+        struct Series {
+            std::atomic<uint64_t> counts[Histogram::kBucketCount];
+            std::atomic<uint64_t> sum;
+            std::atomic<uint64_t> max;
+        };
+        Series series[kMetricCount];
+        std::atomic<uint64_t> counters[kCounterCount];
+        ThreadHistograms* next = nullptr;
+    };
+
+    // Append-only; a thread's record outlives it so its counts stay in the totals.
+    std::atomic<ThreadHistograms*> threadHistograms{ nullptr };
+
+    ThreadHistograms* registerThread() {
+        ThreadHistograms* record = new ThreadHistograms();
+        ThreadHistograms* head = threadHistograms.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!threadHistograms.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+        return record;
+    }
+
+    ThreadHistograms& localHistograms() {
+        thread_local ThreadHistograms* local = registerThread();
+        return *local;
+    }
+
+    void bump(std::atomic<uint64_t>& counter, uint64_t by) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    struct MetricInfo {
+        const char* name;
+        const char* help;
+        double scale;   // multiplier from recorded units to exported units
+    };
+
+    const MetricInfo kMetricInfo[kMetricCount] = {
+        { "chat_receive_to_send_seconds", "Time from receiving a chat message to sending it to one recipient.", 1e-9 },
+        { "chat_fanout_seconds", "Time to queue one broadcast for the members of a room on one shard.", 1e-9 },
+        { "chat_queue_depth_frames", "Frames in a recipient's outbound queue after an enqueue.", 1.0 },
+    };
+
+    const MetricInfo kCounterInfo[kCounterCount] = {
+        { "chat_outbound_frames_dropped_total", "Frames dropped because a recipient's outbound queue was full.", 1.0 },
+        { "chat_outbound_bytes_dropped_total", "Bytes of frames dropped because a recipient's outbound queue was full.", 1.0 },
+        { "chat_slow_consumer_disconnects_total", "Connections closed because their outbound queue overflowed.", 1.0 },
+        { "chat_missed_message_summaries_total", "Summary notices sent to clients in place of dropped messages.", 1.0 },
+        { "chat_pool_allocations_total", "Blocks handed out by the per-thread buffer pool.", 1.0 },
+        { "chat_pool_slabs_total", "Slabs the buffer pool took from the global allocator.", 1.0 },
+        { "chat_pool_remote_releases_total", "Buffer pool blocks released on a thread other than their owner's.", 1.0 },
+        { "chat_pool_oversize_allocations_total", "Requests too large for the buffer pool, served by the global allocator.", 1.0 },
+        { "chat_relay_frames_sent_total", "Frames forwarded to peer nodes.", 1.0 },
+        { "chat_relay_frames_received_total", "Frames received from peer nodes.", 1.0 },
+        { "chat_relay_frames_dropped_total", "Frames not forwarded because a peer link was down or backed up.", 1.0 },
+        { "chat_client_rate_limited_frames_total", "Client frames dropped for exceeding the client's rate limit.", 1.0 },
+        { "chat_address_rate_limited_frames_total", "Client frames dropped for exceeding their source address's rate limit.", 1.0 },
+        { "chat_rate_limited_bytes_total", "Bytes of client frames dropped by rate limits.", 1.0 },
+        { "chat_connections_refused_total", "Connections refused for exceeding the per-address connection limit.", 1.0 },
+    };
+
+    const double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    void appendSample(std::string& out, const char* name, const char* suffix, const char* labels, double value) {
+        char line[256];
+        snprintf(line, sizeof(line), "%s%s%s %.9g\n", name, suffix, labels, value);
+        out += line;
+    }
+
+    SOCKET metricsSocket = INVALID_SOCKET;
+    std::atomic<bool> metricsRunning{ false };
+    std::thread metricsThread;
+
+    // Pause after a failed accept, doubling while it keeps failing, so a
+    // persistent error such as running out of descriptors doesn't spin.
+    const auto kAcceptRetryMin = std::chrono::milliseconds(10);
+    const auto kAcceptRetryMax = std::chrono::milliseconds(1000);
+
+    // One request per connection: read whatever request was sent, answer
+    // with the current snapshot and close.
+    void serveMetrics() {
+        auto retryDelay = kAcceptRetryMin;
+        while (metricsRunning) {
+            SOCKET client = accept(metricsSocket, nullptr, nullptr);
+            if (client == INVALID_SOCKET) {
+                if (metricsRunning) {
+                    logWarn("Metrics accept failed. Error: ", lastSocketError());
+                    std::this_thread::sleep_for(retryDelay);
+                    retryDelay = std::min(retryDelay * 2, kAcceptRetryMax);
+                }
+                continue;
+            }
+            retryDelay = kAcceptRetryMin;
+
+            pollfd request = { client, POLLIN, 0 };
+            if (pollSockets(&request, 1, 1000) > 0) {
+                char buf[4096];
+                recv(client, buf, sizeof(buf), 0);
+            }
+
+            std::string body = formatMetrics();
+            std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            size_t sent = 0;
+            while (sent < response.size()) {
+                int result = send(client, response.data() + sent, (int)(response.size() - sent), MSG_NOSIGNAL);
+                if (result == SOCKET_ERROR) {
+                    break;
+                }
+                sent += result;
+            }
+            closesocket(client);
+        }
+    }
+}
+
+uint64_t metricsNow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void recordMetric(Metric metric, uint64_t value) {
+    ThreadHistograms::Series& series = localHistograms().series[(size_t)metric];
+    bump(series.counts[Histogram::indexOf(value)], 1);
+    bump(series.sum, value);
+    if (value > series.max.load(std::memory_order_relaxed)) {
+        series.max.store(value, std::memory_order_relaxed);
+    }
+}
+
+void countEvent(Counter counter, uint64_t by) {
+    bump(localHistograms().counters[(size_t)counter], by);
+}
+
+uint64_t snapshotCounter(Counter counter) {
+    uint64_t total = 0;
+    for (ThreadHistograms* t = threadHistograms.load(std::memory_order_acquire); t != nullptr; t = t->next) {
+        total += t->counters[(size_t)counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+Histogram snapshotMetric(Metric metric) {
+    Histogram merged;
+    for (ThreadHistograms* t = threadHistograms.load(std::memory_order_acquire); t != nullptr; t = t->next) {
+        const ThreadHistograms::Series& series = t->series[(size_t)metric];
+        for (size_t i = 0; i < Histogram::kBucketCount; ++i) {
+            uint64_t count = series.counts[i].load(std::memory_order_relaxed);
+            if (count != 0) {
+                merged.add(i, count);
+            }
+        }
+        merged.addSum(series.sum.load(std::memory_order_relaxed));
+        merged.addMax(series.max.load(std::memory_order_relaxed));
+    }
+    return merged;
+}
+
+std::string formatMetrics() {
+    std::string out;
+    for (size_t m = 0; m < kMetricCount; ++m) {
+        const MetricInfo& info = kMetricInfo[m];
+        Histogram histogram = snapshotMetric((Metric)m);
+
+        out += "# HELP "; out += info.name; out += ' '; out += info.help; out += '\n';
+        out += "# TYPE "; out += info.name; out += " summary\n";
+        for (double q : kQuantiles) {
+            char labels[32];
+            snprintf(labels, sizeof(labels), "{quantile=\"%g\"}", q);
+            appendSample(out, info.name, "", labels, (double)histogram.percentile(q) * info.scale);
+        }
+        appendSample(out, info.name, "_sum", "", (double)histogram.sumOfValues() * info.scale);
+        appendSample(out, info.name, "_count", "", (double)histogram.count());
+
+        out += "# TYPE "; out += info.name; out += "_max gauge\n";
+        appendSample(out, info.name, "_max", "", (double)histogram.max() * info.scale);
+    }
+    for (size_t c = 0; c < kCounterCount; ++c) {
+        const MetricInfo& info = kCounterInfo[c];
+        out += "# HELP "; out += info.name; out += ' '; out += info.help; out += '\n';
+        out += "# TYPE "; out += info.name; out += " counter\n";
+        appendSample(out, info.name, "", "", (double)snapshotCounter((Counter)c));
+    }
+    return out;
+}
+
+bool startMetricsServer(uint16_t port) {
+    metricsSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (metricsSocket == INVALID_SOCKET) {
+        logError("Metrics socket creation failed. Error: ", lastSocketError());
+        return false;
+    }
+
+#ifndef _WIN32
+    // Scrapes leave TIME_WAIT connections behind; don't let them block a restart.
+    int reuse = 1;
+    setsockopt(metricsSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+#endif
+
+    // Loopback only: metrics are for a local agent, not for the chat clients
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(metricsSocket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR
+        || listen(metricsSocket, 16) == SOCKET_ERROR) {
+        logError("Metrics bind failed. Error: ", lastSocketError());
+        closesocket(metricsSocket);
+        metricsSocket = INVALID_SOCKET;
+        return false;
+    }
+
+    metricsRunning = true;
+    metricsThread = std::thread(serveMetrics);
+    logInfo("Metrics are served on 127.0.0.1:", port, ".");
+    return true;
+}
+
+void stopMetricsServer() {
+    if (!metricsRunning.exchange(false)) {
+        return;
+    }
+    // Shutting the socket down wakes the blocked accept()
+    shutdown(metricsSocket, SD_BOTH);
+    closesocket(metricsSocket);
+    metricsThread.join();
+    metricsSocket = INVALID_SOCKET;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Histogram.h"
+
+// Latency and depth distributions recorded on the hot path.
+//
+// Each thread records into its own histograms with plain relaxed stores, so
+// recording never takes a lock or contends on a cache line. Readers merge the
+// per-thread histograms on demand; a snapshot may miss records that land
+// while it is being taken, but never sees torn counts.
+enum class Metric {
+    ReceiveToSend,  // ns from the recv() that carried a chat message to its send() to a recipient
+    FanOut,         // ns spent queueing one broadcast to a room's members on one shard
+    QueueDepth,     // frames in a recipient's outbound queue after an enqueue
+    Count
+};
+
+// Event counts, kept per thread like the histograms.
+enum class Counter {
+    FramesDropped,      // frames discarded from or refused by a full outbound queue
+    BytesDropped,       // bytes of those frames
+    SlowDisconnects,    // connections closed for overflowing their outbound queue
+    SummariesSent,      // "you missed N messages" notices sent in place of dropped frames
+    PoolAllocations,    // blocks handed out by the buffer pool
+    PoolSlabs,          // slabs the buffer pool took from the global allocator
+    PoolRemoteReleases, // pool blocks released on a thread other than their owner's
+    PoolOversize,       // requests too large for the pool, passed to operator new
+    RelayFramesSent,    // frames forwarded to peer nodes
+    RelayFramesReceived, // frames received from peer nodes
+    RelayFramesDropped, // frames not forwarded because a peer link was down or backed up
+    ClientFramesShed,   // client frames dropped for exceeding the client's rate limit
+    AddressFramesShed,  // client frames dropped for exceeding their address's rate limit
+    BytesShed,          // bytes of those frames
+    ConnectionsRefused, // connections closed on accept for exceeding the per-address limit
+    Count
+};
+
+// Monotonic clock in nanoseconds, the unit of the latency metrics.
+uint64_t metricsNow();
+
+// Records one value into the calling thread's histogram. Lock-free.
+void recordMetric(Metric metric, uint64_t value);
+
+// Adds to the calling thread's counter. Lock-free.
+void countEvent(Counter counter, uint64_t by = 1);
+
+// Sums every thread's counter.
+uint64_t snapshotCounter(Counter counter);
+
+// Merges every thread's histogram for the metric.
+Histogram snapshotMetric(Metric metric);
+
+// All metrics in the Prometheus text exposition format.
+std::string formatMetrics();
+
+// Serves formatMetrics() over HTTP on 127.0.0.1:port from a background thread.
+bool startMetricsServer(uint16_t port);
+void stopMetricsServer();
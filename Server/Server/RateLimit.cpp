@@ -0,0 +1,79 @@
+#include "RateLimit.h"
+
+#include <algorithm>
+
+bool TokenBucket::refill(const RateLimit& limit, double cost, uint64_t nowNs) {
+    if (tokens < 0) {
+        tokens = limit.burst;
+    } else if (nowNs > refilledAt) {
+        tokens = std::min(limit.burst, tokens + (double)(nowNs - refilledAt) * 1e-9 * limit.perSecond);
+    }
+    refilledAt = std::max(refilledAt, nowNs);
+    return tokens >= cost;
+}
+
+bool Throttle::admit(const TrafficLimits& limits, size_t frameBytes, uint64_t nowNs) {
+    if (!allows(limits, frameBytes, nowNs)) {
+        return false;
+    }
+    charge(limits, frameBytes);
+    return true;
+}
+
+bool Throttle::allows(const TrafficLimits& limits, size_t frameBytes, uint64_t nowNs) {
+    bool messageOk = !limits.messages.enabled() || messages.refill(limits.messages, 1, nowNs);
+    bool bytesOk = !limits.bytes.enabled() || bytes.refill(limits.bytes, (double)frameBytes, nowNs);
+    return messageOk && bytesOk;
+}
+
+void Throttle::charge(const TrafficLimits& limits, size_t frameBytes) {
+    if (limits.messages.enabled()) {
+        messages.take(1);
+    }
+    if (limits.bytes.enabled()) {
+        bytes.take((double)frameBytes);
+    }
+}
+
+AddressLimiter::AddressLimiter(size_t maxConnections, const TrafficLimits& limits)
+    : maxConnections(maxConnections), limits(limits) {
+}
+
+SourceAddress* AddressLimiter::admit(SOCKET s) {
+    sockaddr_storage peer = {};
+    socklen_t peerSize = sizeof(peer);
+    char text[INET6_ADDRSTRLEN] = "unknown";
+    if (getpeername(s, (sockaddr*)&peer, &peerSize) == 0) {
+        const void* address = peer.ss_family == AF_INET6
+            ? (const void*)&((const sockaddr_in6*)&peer)->sin6_addr
+            : (const void*)&((const sockaddr_in*)&peer)->sin_addr;
+        inet_ntop(peer.ss_family, address, text, sizeof(text));
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    std::unique_ptr<SourceAddress>& source = sources[text];
+    if (!source) {
+        source = std::make_unique<SourceAddress>();
+        source->address = text;
+    }
+    if (maxConnections != 0 && source->connections >= maxConnections) {
+        return nullptr;
+    }
+    source->connections++;
+    return source.get();
+}
+
+void AddressLimiter::release(SourceAddress* source) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (--source->connections == 0) {
+        sources.erase(source->address);
+    }
+}
+
+bool AddressLimiter::admitFrame(SourceAddress& source, size_t frameBytes, uint64_t nowNs) {
+    if (!limits.messages.enabled() && !limits.bytes.enabled()) {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(source.mutex);
+    return source.throttle.admit(limits, frameBytes, nowNs);
+}
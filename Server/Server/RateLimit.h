@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "Net.h"
+
+// A sustained rate and the burst allowed on top of it. A zero rate disables
+// the limit.
+struct RateLimit {
+    double perSecond = 0;
+    double burst = 0;
+
+    bool enabled() const { return perSecond > 0; }
+};
+
+// Budgets for what one sender may push into the server.
+struct TrafficLimits {
+    RateLimit messages;     // frames
+    RateLimit bytes;        // frame bytes, header included
+};
+
+// Token bucket: holds up to burst tokens and refills at perSecond. Starts full.
+class TokenBucket {
+public:
+    // Refills for the time elapsed since the last call, then reports whether
+    // cost tokens are available. Does not take them.
+    bool refill(const RateLimit& limit, double cost, uint64_t nowNs);
+    void take(double cost) { tokens -= cost; }
+
+private:
+    double tokens = -1;     // negative until first used
+    uint64_t refilledAt = 0;
+};
+
+// A message and a byte bucket charged together: a frame passes only if both
+// have room for it, and then it is charged to both.
+class Throttle {
+public:
+    bool admit(const TrafficLimits& limits, size_t frameBytes, uint64_t nowNs);
+
+    // admit() in two steps, for a frame that must also pass another limit
+    // before it is charged to this one: allows() refills and reports whether
+    // both buckets have room, charge() then takes it.
+    bool allows(const TrafficLimits& limits, size_t frameBytes, uint64_t nowNs);
+    void charge(const TrafficLimits& limits, size_t frameBytes);
+
+private:
+    TokenBucket messages;
+    TokenBucket bytes;
+};
+
+// Limits shared by every connection from one source address.
+struct SourceAddress {
+    std::string address;        // printable, for logs
+    size_t connections = 0;     // guarded by the AddressLimiter's lock
+    std::mutex mutex;
+    Throttle throttle;          // guarded by mutex
+};
+
+// Admission control and traffic limits per source address, shared by every
+// shard. Bursts from one host are capped however many connections it opens
+// and whichever shards those land on; entries live as long as a connection
+// from the address does.
+class AddressLimiter {
+public:
+    AddressLimiter(size_t maxConnections, const TrafficLimits& limits);
+
+    // Registers a connection from the peer of the socket. Returns nullptr if
+    // the address already has maxConnections connections.
+    SourceAddress* admit(SOCKET s);
+    void release(SourceAddress* source);
+
+    // Charges a frame from the address. Lock-free when no address limit is set.
+    bool admitFrame(SourceAddress& source, size_t frameBytes, uint64_t nowNs);
+
+private:
+    size_t maxConnections;     // 0 is unlimited
+    TrafficLimits limits;
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<SourceAddress>> sources;   // guarded by mutex
+};
@@ -0,0 +1,196 @@
+#include "Relay.h"
+
+#include <chrono>
+#include <cstdlib>
+#include "Logger.h"
+#include "Metrics.h"
+
+namespace {
+    // Frames allowed to wait for one peer before new ones are dropped.
+    const size_t kMaxRelayQueuedBytes = 8 * 1024 * 1024;
+
+    const size_t kMaxFramesPerSend = 64;
+    const auto kReconnectDelay = std::chrono::seconds(1);
+}
+
+bool parsePeerAddress(std::string_view address, std::string& host, uint16_t& port) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string_view::npos || colon == 0) {
+        return false;
+    }
+    std::string portText(address.substr(colon + 1));
+    char* end = nullptr;
+    unsigned long value = strtoul(portText.c_str(), &end, 10);
+    if (portText.empty() || *end != '\0' || value == 0 || value > 65535) {
+        return false;
+    }
+    host = std::string(address.substr(0, colon));
+    port = (uint16_t)value;
+    return true;
+}
+
+RelayLink::RelayLink(std::string host, uint16_t port, uint32_t nodeId, std::chrono::milliseconds heartbeat)
+    : host(std::move(host)), port(port), nodeId(nodeId), heartbeat(heartbeat) {
+    peerName = this->host + ":" + std::to_string(port);
+}
+
+RelayLink::~RelayLink() {
+    stop();
+}
+
+void RelayLink::start() {
+    running = true;
+    sender = std::thread(&RelayLink::senderLoop, this);
+}
+
+void RelayLink::stop() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!running) {
+            return;
+        }
+        running = false;
+        // Wakes a sender blocked in send()
+        if (sock != INVALID_SOCKET) {
+            shutdown(sock, SD_BOTH);
+        }
+    }
+    wake.notify_one();
+    sender.join();
+}
+
+void RelayLink::forward(const SharedFrame& frame, uint32_t userId, std::string_view userName) {
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!connected || queuedBytes + frame.size() > kMaxRelayQueuedBytes) {
+            countEvent(Counter::RelayFramesDropped);
+            return;
+        }
+        wasEmpty = queue.empty();
+        if (announced.insert(userId).second) {
+            std::string entry;
+            appendUserEntry(entry, userId, userName);
+            SharedFrame names = SharedFrame::encode(FrameType::Users, { entry });
+            queuedBytes += names.size();
+            queue.push_back(names);
+        }
+        queuedBytes += frame.size();
+        queue.push_back(frame);
+    }
+    if (wasEmpty) {
+        wake.notify_one();
+    }
+}
+
+// Blocking connect and RelayHello; the sender thread has nothing else to do.
+bool RelayLink::connectToPeer() {
+    SOCKET s = connectSocket(host.c_str(), port);
+    if (s == INVALID_SOCKET) {
+        return false;
+    }
+
+    // Relayed frames are latency-sensitive and already batched
+    int noDelay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+    char hello[kUserIdSize];
+    putUint32(hello, nodeId);
+    std::string frame = encodeFrame(FrameType::RelayHello, std::string_view(hello, sizeof(hello)));
+    if (send(s, frame.data(), (int)frame.size(), MSG_NOSIGNAL) != (int)frame.size()) {
+        closesocket(s);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!running) {
+        closesocket(s);
+        return false;
+    }
+    sock = s;
+    connected = true;
+    announced.clear();
+    return true;
+}
+
+// Writes the frames in gathered sends of up to kMaxFramesPerSend frames.
+bool RelayLink::sendBatch(std::vector<SharedFrame>& batch) {
+    IoBuffer buffers[kMaxFramesPerSend];
+    size_t next = 0;        // first frame not yet fully sent
+    size_t offset = 0;      // bytes of batch[next] already sent
+    while (next < batch.size()) {
+        size_t count = 0;
+        for (size_t i = next; i < batch.size() && count < kMaxFramesPerSend; ++i, ++count) {
+            size_t skip = i == next ? offset : 0;
+            setIoBuffer(buffers[count], batch[i].data() + skip, batch[i].size() - skip);
+        }
+        int sent = sendBuffers(sock, buffers, count);
+        if (sent == SOCKET_ERROR) {
+            return false;
+        }
+        size_t bytes = (size_t)sent;
+        while (bytes > 0) {
+            size_t remaining = batch[next].size() - offset;
+            if (bytes < remaining) {
+                offset += bytes;
+                break;
+            }
+            bytes -= remaining;
+            offset = 0;
+            ++next;
+        }
+    }
+    countEvent(Counter::RelayFramesSent, batch.size());
+    return true;
+}
+
+void RelayLink::senderLoop() {
+    std::vector<SharedFrame> batch;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (!running) {
+                break;
+            }
+        }
+
+        if (!connectToPeer()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, kReconnectDelay, [this]() { return !running; });
+            continue;
+        }
+        logInfo("Relay link to ", peerName, " is up.");
+
+        bool healthy = true;
+        int error = 0;
+        while (healthy) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto ready = [this]() { return !queue.empty() || !running; };
+                if (heartbeat.count() == 0) {
+                    wake.wait(lock, ready);
+                } else if (!wake.wait_for(lock, heartbeat, ready)) {
+                    queue.push_back(SharedFrame::encode(FrameType::Pong, {}));
+                }
+                if (!running) {
+                    break;
+                }
+                batch.swap(queue);
+                queuedBytes = 0;
+            }
+            healthy = sendBatch(batch);
+            error = healthy ? 0 : lastSocketError();
+            batch.clear();
+        }
+
+        std::lock_guard<std::mutex> guard(mutex);
+        connected = false;
+        queue.clear();
+        queuedBytes = 0;
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+        if (running) {
+            logWarn("Relay link to ", peerName, " failed. Error: ", error, ". Reconnecting.");
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "Net.h"
+#include "SharedFrame.h"
+
+// Outbound half of a federation link: forwards this node's room broadcasts
+// to one peer node, which delivers them to its own members of the room.
+//
+// forward() only queues a reference to the already-encoded frame. A sender
+// thread owns the socket: it connects (and reconnects) to the peer, then
+// writes whatever has queued since its last write as one batch of gathered
+// sends, so a busy room costs the link a few large writes rather than one
+// per message. While the link is down frames are dropped and counted, not
+// buffered: the peer's clients missed them live either way.
+//
+// The link never reads, so instead of answering pings it sends a Pong of
+// its own whenever it has been quiet for the heartbeat interval, keeping the
+// peer's idle timeout from closing it.
+//
+// Links are one-way. For a full mesh every node lists every other node as a
+// peer; frames that arrive over a relay are never forwarded again.
+class RelayLink {
+public:
+    // A zero heartbeat sends none.
+    RelayLink(std::string host, uint16_t port, uint32_t nodeId, std::chrono::milliseconds heartbeat);
+    ~RelayLink();
+
+    RelayLink(const RelayLink&) = delete;
+    RelayLink& operator=(const RelayLink&) = delete;
+
+    void start();
+    void stop();
+
+    // Queues a room frame sent by the given user. The first frame from a
+    // user on each connection is preceded by a Users frame naming them.
+    // Safe to call from any thread.
+    void forward(const SharedFrame& frame, uint32_t userId, std::string_view userName);
+
+    const std::string& peer() const { return peerName; }
+
+private:
+    bool connectToPeer();
+    bool sendBatch(std::vector<SharedFrame>& batch);
+    void senderLoop();
+
+    std::string host;
+    uint16_t port;
+    uint32_t nodeId;
+    std::string peerName;   // host:port, for logs
+    std::chrono::milliseconds heartbeat;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<SharedFrame> queue;         // guarded by mutex
+    size_t queuedBytes = 0;                 // guarded by mutex
+    bool connected = false;                 // guarded by mutex
+    bool running = false;                   // guarded by mutex
+    std::unordered_set<uint32_t> announced; // guarded by mutex: users already named on this connection
+    SOCKET sock = INVALID_SOCKET;           // sender thread
+    std::thread sender;
+};
+
+// Parses "host:port" into its parts.
+bool parsePeerAddress(std::string_view address, std::string& host, uint16_t& port);
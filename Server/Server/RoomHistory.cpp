@@ -0,0 +1,27 @@
+#include "RoomHistory.h"
+
+#include <algorithm>
+
+RoomHistory::RoomHistory(size_t capacity)
+    : slotCount(capacity), slots(new SharedFrame[capacity]) {
+}
+
+size_t RoomHistory::size() const {
+    return (size_t)std::min<uint64_t>(recorded, slotCount);
+}
+
+void RoomHistory::record(const SharedFrame& frame) {
+    if (slotCount == 0) {
+        return;
+    }
+    slots[recorded % slotCount] = frame;
+    ++recorded;
+}
+
+void RoomHistory::snapshot(std::vector<SharedFrame>& out) const {
+    out.clear();
+    size_t count = (size_t)std::min<uint64_t>(recorded, slotCount);
+    for (uint64_t i = recorded - count; i < recorded; ++i) {
+        out.push_back(slots[i % slotCount]);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "SharedFrame.h"
+
+// The last few frames broadcast to a room, kept as references to the frames
+// already encoded for the broadcast. A new member is caught up by splicing
+// them into its outbound queue: no re-encoding and no disk reads.
+//
+// The slots are one contiguous array overwritten in a circle, so recording a
+// frame is a reference count bump and an index increment. Not thread-safe:
+// the owning Room records and snapshots it under the lock that already
+// orders its broadcasts.
+class RoomHistory {
+public:
+    explicit RoomHistory(size_t capacity);
+
+    size_t capacity() const { return slotCount; }
+    // Frames currently held; reaches capacity() and stays there.
+    size_t size() const;
+
+    void record(const SharedFrame& frame);
+
+    // Replaces out's contents with the held frames, oldest first.
+    void snapshot(std::vector<SharedFrame>& out) const;
+
+private:
+    size_t slotCount;
+    std::unique_ptr<SharedFrame[]> slots;
+    uint64_t recorded = 0;      // frames ever recorded; the next slot is recorded % slotCount
+};
@@ -0,0 +1,90 @@
+#include "Rooms.h"
+
+#include <algorithm>
+#include <chrono>
+#include "MessageLog.h"
+#include "Protocol.h"
+
+Room::Room(std::string_view name, size_t shardCount, size_t historySize, MessageLog* log)
+    : roomName(name), roomTag(::roomTag(name)), shards(shardCount), shardMembers(new ClientRegistry[shardCount]),
+      log(log), recent(historySize), pending(new std::vector<Delivery>[shardCount]) {
+    auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    nextSequence = std::max<uint64_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count());
+}
+
+uint64_t Room::publish(SharedFrame& frame, SOCKET sender, std::vector<size_t>& wake) {
+    std::lock_guard<std::mutex> guard(publishMutex);
+    uint64_t sequence = nextSequence++;
+    frame.setSequence(sequence);
+    recent.record(frame);
+    if (log != nullptr) {
+        log->append(frame);
+    }
+    for (size_t shard = 0; shard < shards; ++shard) {
+        if (shardMembers[shard].size() == 0) {
+            continue;
+        }
+        if (pending[shard].empty()) {
+            wake.push_back(shard);
+        }
+        pending[shard].push_back({ frame, sender });
+    }
+    return sequence;
+}
+
+// The frames already queued for the shard were published before the member
+// was added, so they are handed back for the other members rather than left
+// for the next drain to deliver to the new one as well.
+void Room::addMember(const std::shared_ptr<Connection>& conn, size_t shard, CatchUp& catchUp) {
+    std::lock_guard<std::mutex> guard(publishMutex);
+    shardMembers[shard].add(conn);
+    totalMembers++;
+    recent.snapshot(catchUp.history);
+    catchUp.queued.clear();
+    catchUp.queued.swap(pending[shard]);
+    catchUp.lastSequence = nextSequence - 1;
+}
+
+void Room::takeDeliveries(size_t shard, std::vector<Delivery>& out) {
+    out.clear();
+    std::lock_guard<std::mutex> guard(publishMutex);
+    out.swap(pending[shard]);
+}
+
+RoomDirectory::RoomDirectory(size_t shardCount, size_t historySize, MessageLog* log)
+    : shardCount(shardCount), historySize(historySize), log(log) {
+}
+
+std::shared_ptr<Room> RoomDirectory::join(std::string_view name, const std::shared_ptr<Connection>& conn, size_t shard, Room::CatchUp& catchUp) {
+    // The member is added under the directory lock so a concurrent leave
+    // cannot drop the room between lookup and add.
+    std::lock_guard<std::mutex> guard(mutex);
+    std::string key(name);
+    auto it = rooms.find(key);
+    if (it == rooms.end()) {
+        it = rooms.emplace(key, std::make_shared<Room>(name, shardCount, historySize, log)).first;
+    }
+    it->second->addMember(conn, shard, catchUp);
+    return it->second;
+}
+
+void RoomDirectory::leave(const std::shared_ptr<Room>& room, const Connection* conn, size_t shard) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (room->shardMembers[shard].remove(conn) && --room->totalMembers == 0) {
+        auto it = rooms.find(room->name());
+        if (it != rooms.end() && it->second == room) {
+            rooms.erase(it);
+        }
+    }
+}
+
+std::shared_ptr<Room> RoomDirectory::find(std::string_view name) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = rooms.find(std::string(name));
+    return it != rooms.end() ? it->second : nullptr;
+}
+
+size_t RoomDirectory::roomCount() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return rooms.size();
+}
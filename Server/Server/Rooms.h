@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "ClientRegistry.h"
+#include "RoomHistory.h"
+#include "SharedFrame.h"
+
+class MessageLog;
+
+// A named chat room. Its member registries are the subscription index that
+// broadcasts fan out over, so a message only reaches the room's members.
+// Members are split by shard: each shard's registry is only written from
+// that shard's loop thread, and a broadcast reaches the members of another
+// shard by posting one task to that shard rather than touching its sockets.
+//
+// Broadcasts are numbered, recorded, logged and queued per shard under one
+// lock, so every shard delivers a room's frames in the same order whichever
+// threads published them, and the message log holds them in that order too.
+// Members are added under the same lock, which splits the room's frames
+// cleanly into those a new member is caught up with and those it receives
+// live. Numbering starts from the wall clock in microseconds when the room
+// is created, so a room that is dropped and recreated, or a restarted
+// server, carries on above the numbers it gave out before.
+class Room {
+public:
+    // A broadcast waiting to be delivered to one shard's members.
+    struct Delivery {
+        SharedFrame frame;
+        SOCKET sender;  // member that sent it and is skipped, or INVALID_SOCKET
+    };
+
+    // The room's state as a member was added. Every frame numbered up to
+    // lastSequence was published before the member joined and only reaches it
+    // through catching up; every later one is delivered to it live.
+    struct CatchUp {
+        std::vector<SharedFrame> history;   // the room's history, oldest first
+        std::vector<Delivery> queued;       // taken from the member's shard; for the other members only
+        uint64_t lastSequence = 0;
+    };
+
+    Room(std::string_view name, size_t shardCount, size_t historySize, MessageLog* log);
+
+    const std::string& name() const { return roomName; }
+    // Length-prefixed name that starts every frame sent to this room.
+    const std::string& tag() const { return roomTag; }
+
+    size_t shardCount() const { return shards; }
+    ClientRegistry& members(size_t shard) { return shardMembers[shard]; }
+    size_t memberCount() const { return totalMembers.load(std::memory_order_relaxed); }
+
+    // Numbers the frame, records it in the history and the message log (if
+    // any) and queues it for every shard with members. The frame must not be
+    // shared yet. Shards whose queue was empty are appended to wake: each
+    // needs takeDeliveries() called on it, while the others already have that
+    // pending. Returns the frame's sequence number.
+    uint64_t publish(SharedFrame& frame, SOCKET sender, std::vector<size_t>& wake);
+
+    // Replaces out's contents with the frames queued for the shard, in
+    // sequence order. Called on the shard's loop thread.
+    void takeDeliveries(size_t shard, std::vector<Delivery>& out);
+
+private:
+    friend class RoomDirectory;
+
+    void addMember(const std::shared_ptr<Connection>& conn, size_t shard, CatchUp& catchUp);
+
+    std::string roomName;
+    std::string roomTag;
+    size_t shards;
+    std::unique_ptr<ClientRegistry[]> shardMembers;
+    std::atomic<size_t> totalMembers{ 0 };
+    MessageLog* log;
+
+    std::mutex publishMutex;
+    RoomHistory recent;                                 // guarded by publishMutex
+    uint64_t nextSequence;                              // guarded by publishMutex
+    std::unique_ptr<std::vector<Delivery>[]> pending;   // guarded by publishMutex, one queue per shard
+};
+
+// Room name -> Room index. Rooms are created on first join and dropped when
+// their last member leaves, history and all. Only joins and leaves touch the
+// directory lock; connections keep a reference to each room they are in, so
+// posting to a room never looks it up here.
+class RoomDirectory {
+public:
+    // Every room keeps its last historySize broadcasts and writes them all to
+    // log, if given.
+    RoomDirectory(size_t shardCount, size_t historySize, MessageLog* log);
+
+    // Adds the member on the calling shard and fills in what it must be
+    // caught up with.
+    std::shared_ptr<Room> join(std::string_view name, const std::shared_ptr<Connection>& conn, size_t shard, Room::CatchUp& catchUp);
+    void leave(const std::shared_ptr<Room>& room, const Connection* conn, size_t shard);
+    // The room, or nullptr if nobody is in it.
+    std::shared_ptr<Room> find(std::string_view name) const;
+    size_t roomCount() const;
+
+private:
+    size_t shardCount;
+    size_t historySize;
+    MessageLog* log;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<Room>> rooms;
+};
@@ -1,169 +1,805 @@
-#include <iostream>
 #include <thread>
 #include <string>
 #include <vector>
-#include <map>
-#include <mutex>
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include "Net.h"
+#include "EventLoop.h"
+#include "Connection.h"
+#include "DetachedTask.h"
+#include "Rooms.h"
+#include "SharedFrame.h"
+#include "MessageLog.h"
+#include "RateLimit.h"
+#include "Relay.h"
+#include "Users.h"
+#include "Metrics.h"
+#include "Logger.h"
 
-#pragma comment(lib, "ws2_32.lib")
+// One event loop per shard. Each shard accepts its own connections and
+// owns their sockets; other shards only ever post tasks to it.
+std::vector<std::unique_ptr<EventLoop>> shards;
+std::unique_ptr<RoomDirectory> rooms;
 
-std::vector<SOCKET> clients;
-std::map<SOCKET, std::string> clientNames;  // Map to store client names
-std::mutex clients_mutex;
+// Null unless the server was started with --message-log.
+std::unique_ptr<MessageLog> messageLog;
 
-void broadcastMessage(const std::string& message, SOCKET sender) {
-    std::lock_guard<std::mutex> guard(clients_mutex);  // Lock the mutex only for this section
+// Messages a new member of a room is caught up with (--replay). Rooms keep up
+// to kMaxRoomHistory of them in memory; the message log serves longer windows.
+size_t replayCount = 0;
+const size_t kMaxRoomHistory = 256;
 
-    for (SOCKET client : clients) {
-        if (client != sender) {
-            int result = send(client, message.c_str(), message.size() + 1, 0);
-            if (result == SOCKET_ERROR) {
-                std::cerr << "Failed to send message to a client. Error: " << WSAGetLastError() << std::endl;
+// One outbound link per peer node given with --peer.
+std::vector<std::unique_ptr<RelayLink>> relayLinks;
+
+// Names of everyone who has connected, by user ID. Persisted next to the
+// message log so replayed frames keep resolving.
+UserTable users;
+
+// What one client, and all clients from one address together, may send.
+TrafficLimits clientLimits;
+std::unique_ptr<AddressLimiter> addressLimiter;
+
+// A throttled client is told (and logged) at most this often, in ns.
+const uint64_t kThrottleNoticeInterval = 10ull * 1000 * 1000 * 1000;
+
+// Caps the rooms one client may be in, bounding per-client fan-out work.
+const size_t kMaxRoomsPerClient = 32;
+
+// Queues each frame to the room's members on the calling shard, except its
+// sender and skip. Only enqueues: each recipient's own event loop drains its
+// queue, so a client with a full TCP window delays nobody but itself. Every
+// queue shares the one frame, so fan-out costs a reference count bump per
+// recipient.
+void deliver(Room& room, size_t shard, const std::vector<Room::Delivery>& deliveries, const Connection* skip) {
+    for (const Room::Delivery& delivery : deliveries) {
+        uint64_t start = metricsNow();
+        // Iterates a lock-free snapshot of the room, so joins and leaves never stall a broadcast
+        room.members(shard).forEach([&](Connection& client) {
+            if (client.socket() != delivery.sender && &client != skip) {
+                // A full queue is handled by the recipient's overflow policy
+                client.queueSend(delivery.frame);
             }
+        });
+        recordMetric(Metric::FanOut, metricsNow() - start);
+    }
+}
+
+// Delivers the room's frames waiting for its members on the calling shard,
+// in sequence order.
+void deliverToShard(Room& room, size_t shard) {
+    thread_local std::vector<Room::Delivery> deliveries;
+    room.takeDeliveries(shard, deliveries);
+    deliver(room, shard, deliveries, nullptr);
+    deliveries.clear();
+}
+
+// Called on the shard the frame arrived on. The room numbers and logs the
+// frame and queues it for each shard with members; local members are served
+// directly, and a shard whose queue was empty gets one task to drain it, so
+// no shard touches another shard's connections. room may be null when nobody
+// on this node is in it; the frame is still logged, unnumbered.
+void publishToRoom(const std::shared_ptr<Room>& room, SharedFrame& message, size_t origin, SOCKET sender) {
+    if (!room) {
+        if (messageLog) {
+            messageLog->append(message);
         }
+        return;
     }
+    thread_local std::vector<size_t> wake;
+    room->publish(message, sender, wake);
+    for (size_t shard : wake) {
+        if (shard != origin) {
+            shards[shard]->post([room, shard]() { deliverToShard(*room, shard); });
+        }
+    }
+    wake.clear();
+    deliverToShard(*room, origin);
 }
 
-void handleClient(SOCKET clientSocket) {
-    char buf[4096];
-    std::string clientName;
+// Called on the sender's shard: reaches the room's members on this node and,
+// through the relay links, on every peer node. The frame is numbered before
+// the links get to share it.
+void broadcastMessage(const std::shared_ptr<Room>& room, SharedFrame& message, const Connection& sender) {
+    publishToRoom(room, message, sender.loop().index(), sender.socket());
+    for (auto& link : relayLinks) {
+        link->forward(message, sender.userId, sender.name);
+    }
+}
 
-    try {
-        // Receive the client's name
-        ZeroMemory(buf, 4096);
-        int bytesReceived = recv(clientSocket, buf, 4096, 0);
-        if (bytesReceived > 0) {
-            clientName = std::string(buf, 0, bytesReceived);
+// Sends a notice about the client's own request (bad room name and so on).
+void sendNotice(Connection& conn, std::string_view text) {
+    conn.queueControl(SharedFrame::encode(FrameType::Notice, { roomTag(""), kNoSequence, text }));
+}
 
-            // Store the client name in the map
-            {
-                std::lock_guard<std::mutex> guard(clients_mutex);
-                clientNames[clientSocket] = clientName;
-            }
+// A member rejoining after a reconnect names the last frame it saw
+// (afterSequence) and is only caught up on the frames after it.
+void joinRoom(Connection& conn, std::string_view roomName, uint64_t afterSequence = 0) {
+    if (!validRoomName(roomName)) {
+        sendNotice(conn, "Invalid room name.");
+        return;
+    }
+    if (conn.rooms.find(roomName) != conn.rooms.end()) {
+        return;
+    }
+    if (conn.rooms.size() >= kMaxRoomsPerClient) {
+        sendNotice(conn, "You are in too many rooms.");
+        return;
+    }
 
-            std::cout << "Client '" << clientName << "' connected." << std::endl;
+    thread_local Room::CatchUp catchUp;
+    std::shared_ptr<Room> room = rooms->join(roomName, conn.shared_from_this(), conn.loop().index(), catchUp);
+    conn.rooms.emplace(room->name(), room);
 
-            // Broadcast to other clients that a new user has joined (OUTSIDE mutex lock)
-            std::string joinMessage = clientName + " has joined the chat.";
-            broadcastMessage(joinMessage, clientSocket);  // Call this outside the mutex lock
-        } else {
-            std::cerr << "Error receiving client name. Closing connection." << std::endl;
-            closesocket(clientSocket);
+    // Frames that were waiting for this shard as the member was added are
+    // part of what it catches up on; the other members still get them here
+    deliver(*room, conn.loop().index(), catchUp.queued, &conn);
+
+    // Catch the new member up on what was said before they arrived. The
+    // room's own history is enough unless it holds fewer messages than the
+    // window, in which case the log (if any) may know more; its frames are
+    // read back off the loop, and the member's later frames wait for them.
+    std::vector<SharedFrame>& recent = catchUp.history;
+    if (messageLog && recent.size() < replayCount) {
+        messageLog->replay(room->name(), conn.shared_from_this(), afterSequence, catchUp.lastSequence);
+    } else {
+        size_t seen = 0;
+        while (seen < recent.size() && recent[seen].sequence() <= afterSequence) {
+            ++seen;
+        }
+        conn.queueSend(recent.data() + seen, recent.size() - seen);
+    }
+    recent.clear();
+    catchUp.queued.clear();
+
+    // Tell the room's other members that a new user has joined
+    SharedFrame joinMessage = SharedFrame::encode(FrameType::Notice, { room->tag(), kNoSequence, conn.name, " has joined the chat." });
+    broadcastMessage(room, joinMessage, conn);
+}
+
+void leaveRoom(Connection& conn, std::string_view roomName) {
+    auto it = conn.rooms.find(roomName);
+    if (it == conn.rooms.end()) {
+        return;
+    }
+    std::shared_ptr<Room> room = it->second;
+    conn.rooms.erase(it);
+    rooms->leave(room, &conn, conn.loop().index());
+
+    SharedFrame leaveMessage = SharedFrame::encode(FrameType::Notice, { room->tag(), kNoSequence, conn.name, " has left the chat." });
+    broadcastMessage(room, leaveMessage, conn);
+}
+
+// Answers a Users request with the names of the requested IDs, split into
+// as many frames as needed. Unknown IDs are left out.
+void sendUserNames(Connection& conn, std::string_view requestedIds) {
+    size_t count = std::min(requestedIds.size() / kUserIdSize, kMaxUserLookup);
+    std::string payload;
+    std::string name;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t userId = getUint32(requestedIds.data() + i * kUserIdSize);
+        if (!users.lookup(userId, name)) {
+            continue;
+        }
+        if (payload.size() + kUserIdSize + 1 + name.size() > kMaxFramePayload) {
+            conn.queueControl(SharedFrame::encode(FrameType::Users, { payload }));
+            payload.clear();
+        }
+        appendUserEntry(payload, userId, name);
+    }
+    conn.queueControl(SharedFrame::encode(FrameType::Users, { payload }));
+}
+
+// Handles a frame from a client that has introduced itself.
+void handleClientFrame(Connection& conn, const Frame& frame) {
+    switch (frame.type) {
+    case FrameType::JoinRoom:
+        joinRoom(conn, frame.payload);
+        break;
+
+    case FrameType::RejoinRoom:
+        if (frame.payload.size() >= kSequenceSize) {
+            joinRoom(conn, frame.payload.substr(kSequenceSize), getUint64(frame.payload.data()));
+        }
+        break;
+
+    case FrameType::LeaveRoom:
+        leaveRoom(conn, frame.payload);
+        break;
+
+    case FrameType::Chat: {
+        std::string_view roomName, text;
+        if (!splitRoomPayload(frame.payload, roomName, text)) {
+            return;
+        }
+        auto it = conn.rooms.find(roomName);
+        if (it == conn.rooms.end()) {
+            sendNotice(conn, "You are not in that room.");
+            return;
+        }
+        const std::shared_ptr<Room>& room = it->second;
+        if (room->tag().size() + kSequenceSize + kUserIdSize + text.size() > kMaxFramePayload) {
+            sendNotice(conn, "Message too long.");
             return;
         }
 
-        // Communication loop
-        while (true) {
-            ZeroMemory(buf, 4096);
-            int bytesReceived = recv(clientSocket, buf, 4096, 0);
-            if (bytesReceived == SOCKET_ERROR || bytesReceived == 0) {
-                // Handle client disconnection (client closed connection or error occurred)
-                {
-                    std::lock_guard<std::mutex> guard(clients_mutex);
-                    auto it = clientNames.find(clientSocket);
-                    if (it != clientNames.end()) {
-                        clientName = it->second;
-
-                        std::cout << "Client '" << clientName << "' disconnected." << std::endl;
-
-                        // Remove the client from the list and map
-                        clients.erase(std::remove(clients.begin(), clients.end(), clientSocket), clients.end());
-                        clientNames.erase(it);
-                    } else {
-                        std::cerr << "Client socket not found in map, possibly already removed." << std::endl;
-                    }
-                }
+        // Construct the message once for all recipients; it names the sender by ID
+        char senderId[kUserIdSize];
+        putUint32(senderId, conn.userId);
+        SharedFrame message = SharedFrame::encode(FrameType::Chat, { room->tag(), kNoSequence, std::string_view(senderId, kUserIdSize), text });
+        message.setReceivedAt(conn.receivedAt());
+        logInfo("Received [", room->name(), "]: ", conn.name, ": ", text);
 
-                // Broadcast that the client has left the chat (OUTSIDE mutex lock)
-                std::string leaveMessage = clientName + " has left the chat.";
-                broadcastMessage(leaveMessage, clientSocket);  // Call this outside the mutex lock
+        // Broadcast the message to the room's other members
+        broadcastMessage(room, message, conn);
+        break;
+    }
 
-                closesocket(clientSocket);
-                break;
-            }
+    case FrameType::Users:
+        sendUserNames(conn, frame.payload);
+        break;
+
+    default:
+        break;  // nothing else is meaningful from a client
+    }
+}
+
+// One client's session, from its name to its disconnect. Runs on the
+// connection's event loop thread and is suspended in nextFrame() between
+// frames, so thousands of sessions share the loop thread without a stack each.
+//
+// Every frame is charged to the client's own budget and then to its
+// address's before it is acted on; frames over budget are dropped here,
+// before they can fan out to a room.
+DetachedTask handleClient(std::shared_ptr<Connection> conn, SourceAddress* source) {
+    struct AddressRelease {
+        SourceAddress* source;
+        ~AddressRelease() { addressLimiter->release(source); }
+    } addressRelease{ source };
+    Throttle throttle;
+    uint64_t throttleNoticeAt = 0;  // receivedAt() of the last "too fast" notice
+
+    // The client must introduce itself with a Hello frame before chatting
+    const Frame* hello = co_await conn->nextFrame();
+    if (hello == nullptr) {
+        logError("Error receiving client name. Closing connection.");
+        co_return;
+    }
+    if (hello->type != FrameType::Hello || !validUserName(hello->payload)) {
+        logError("Client did not send its name first. Closing connection.");
+        conn->close();
+        co_return;
+    }
+    conn->name = std::string(hello->payload);
+    conn->userId = users.intern(conn->name);
+    if (conn->userId == UserTable::kNoUser) {
+        logError("User table is full; refusing new user '", conn->name, "'. Closing connection.");
+        conn->close();
+        co_return;
+    }
+
+    std::string welcome;
+    appendUserId(welcome, conn->userId);
+    conn->queueControl(SharedFrame::encode(FrameType::Welcome, { welcome }));
+
+    logInfo("Client '", conn->name, "' connected.");
+    joinRoom(*conn, kLobbyRoom);
 
-            // Get the client's name and construct the message
-            std::string message = clientName + ": " + std::string(buf, 0, bytesReceived);
-            std::cout << "Received: " << message << std::endl;
+    // However the session ends, leave every room, telling each that the
+    // client has left the chat
+    struct RoomsRelease {
+        Connection& conn;
+        ~RoomsRelease() {
+            while (!conn.rooms.empty()) {
+                std::string roomName = conn.rooms.begin()->first;
+                leaveRoom(conn, roomName);
+            }
+        }
+    } roomsRelease{ *conn };
 
-            // Broadcast the message to other clients (OUTSIDE mutex lock)
-            broadcastMessage(message, clientSocket);  // Call this outside the mutex lock
+    // Serve the client until it closes the connection or a socket error occurs
+    while (const Frame* frame = co_await conn->nextFrame()) {
+        size_t frameBytes = kFrameHeaderSize + frame->payload.size();
+        // The client's own budget is only charged for frames its address
+        // also admits, so a busy neighbour doesn't drain it
+        bool clientOk = throttle.allows(clientLimits, frameBytes, conn->receivedAt());
+        if (!clientOk || !addressLimiter->admitFrame(*source, frameBytes, conn->receivedAt())) {
+            countEvent(clientOk ? Counter::AddressFramesShed : Counter::ClientFramesShed);
+            countEvent(Counter::BytesShed, frameBytes);
+            if (throttleNoticeAt == 0 || conn->receivedAt() - throttleNoticeAt >= kThrottleNoticeInterval) {
+                throttleNoticeAt = conn->receivedAt();
+                logWarn("Client '", conn->name, "' from ", source->address, " is over its rate limit; dropping its messages.");
+                sendNotice(*conn, "You are sending too fast; some of your messages were dropped.");
+            }
+            continue;
         }
+        throttle.charge(clientLimits, frameBytes);
+        handleClientFrame(*conn, *frame);
+    }
+    logInfo("Client '", conn->name, "' disconnected.");
+}
 
-    } catch (const std::exception& ex) {
-        std::cerr << "Exception occurred in client handler: " << ex.what() << std::endl;
-    } catch (...) {
-        std::cerr << "Unknown exception occurred in client handler." << std::endl;
+// One inbound relay link from a peer node. Its frames reach this node's
+// members of each room and the message log, but are never forwarded again.
+DetachedTask handleRelayLink(std::shared_ptr<Connection> conn) {
+    const Frame* hello = co_await conn->nextFrame();
+    if (hello == nullptr) {
+        co_return;
+    }
+    if (hello->type != FrameType::RelayHello || hello->payload.size() != kUserIdSize) {
+        logError("Relay peer did not introduce itself. Closing link.");
+        conn->close();
+        co_return;
     }
+    uint32_t peerNode = getUint32(hello->payload.data());
+    if (peerNode == users.node()) {
+        // A peer sharing our node ID would hand out the same user IDs
+        logError("Relay peer claims this node's ID ", peerNode, ". Closing link.");
+        conn->close();
+        co_return;
+    }
+    logInfo("Relay link from node ", peerNode, " is up.");
 
-    closesocket(clientSocket);  // Ensure the socket is always closed
+    while (const Frame* frame = co_await conn->nextFrame()) {
+        countEvent(Counter::RelayFramesReceived);
+        if (frame->type == FrameType::Users) {
+            parseUserEntries(frame->payload, [](uint32_t userId, std::string_view name) {
+                users.remember(userId, name);
+            });
+            continue;
+        }
+
+        std::string_view roomName, text;
+        uint64_t peerSequence;
+        if ((frame->type != FrameType::Chat && frame->type != FrameType::Notice)
+            || !splitSequencedPayload(frame->payload, roomName, peerSequence, text) || !validRoomName(roomName)) {
+            continue;
+        }
+        // The peer numbered the frame for its own members; ours get this node's numbering
+        SharedFrame message = SharedFrame::encode(frame->type, { frame->payload });
+        message.setSequence(0);
+        message.setReceivedAt(conn->receivedAt());
+        publishToRoom(rooms->find(roomName), message, conn->loop().index(), INVALID_SOCKET);
+    }
+    logWarn("Relay link from node ", peerNode, " closed.");
 }
 
-int main() {
-    // Initialize Winsock
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "Failed to initialize Winsock." << std::endl;
-        return 1;
+// Accepts clients on the listening socket from an event loop: a readiness
+// loop reports the socket readable and we accept until it would block, a
+// completion loop hands over each socket from its multishot accept.
+class Acceptor : public IoHandler {
+public:
+    Acceptor(SOCKET listener, std::function<void(SOCKET)> onClient)
+        : listener(listener), onClient(std::move(onClient)) {
     }
 
-    // Create a listening socket
-    SOCKET serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket == INVALID_SOCKET) {
-        std::cerr << "Socket creation failed. Error: " << WSAGetLastError() << std::endl;
-        WSACleanup();
-        return 1;
+    void onReadable() override {
+        while (true) {
+            SOCKET clientSocket = accept(listener, nullptr, nullptr);
+            if (clientSocket == INVALID_SOCKET) {
+                if (!isWouldBlock(lastSocketError())) {
+                    logError("Accept failed. Error: ", lastSocketError());
+                }
+                return;
+            }
+            onClient(clientSocket);
+        }
+    }
+
+    void onAccepted(SOCKET clientSocket) override {
+        onClient(clientSocket);
+    }
+
+private:
+    SOCKET listener;
+    std::function<void(SOCKET)> onClient;
+};
+
+#ifdef SO_REUSEPORT
+const bool kHaveReusePort = true;
+#else
+const bool kHaveReusePort = false;
+#endif
+
+// Creates a non-blocking listening socket on the port. With reusePort every
+// shard binds its own socket to the same port and the kernel spreads
+// incoming connections across them.
+SOCKET openListener(uint16_t port, bool reusePort) {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) {
+        logError("Socket creation failed. Error: ", lastSocketError());
+        return INVALID_SOCKET;
     }
 
+    int enable = 1;
+#ifndef _WIN32
+    // Lets a restarted server bind while old connections sit in TIME_WAIT
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&enable, sizeof(enable));
+#endif
+#ifdef SO_REUSEPORT
+    if (reusePort && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&enable, sizeof(enable)) == SOCKET_ERROR) {
+        logError("Failed to enable SO_REUSEPORT. Error: ", lastSocketError());
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+#else
+    (void)reusePort;
+    (void)enable;
+#endif
+
     // Bind the socket to an IP and port
-    sockaddr_in serverAddr;
+    sockaddr_in serverAddr = {};
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = INADDR_ANY;  // Listen on any IP address
-    serverAddr.sin_port = htons(54000);       // Port number
+    serverAddr.sin_port = htons(port);
 
-    if (bind(serverSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        std::cerr << "Bind failed. Error: " << WSAGetLastError() << std::endl;
-        closesocket(serverSocket);
-        WSACleanup();
-        return 1;
+    if (bind(s, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        logError("Bind failed. Error: ", lastSocketError());
+        closesocket(s);
+        return INVALID_SOCKET;
     }
 
     // Listen for incoming connections
-    if (listen(serverSocket, SOMAXCONN) == SOCKET_ERROR) {
-        std::cerr << "Listen failed. Error: " << WSAGetLastError() << std::endl;
-        closesocket(serverSocket);
-        WSACleanup();
+    if (listen(s, SOMAXCONN) == SOCKET_ERROR) {
+        logError("Listen failed. Error: ", lastSocketError());
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+
+    if (!setNonBlocking(s)) {
+        logError("Failed to make listening socket non-blocking. Error: ", lastSocketError());
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// Limits of the given rates with two seconds' worth of burst. The byte burst
+// always fits the largest frame, or such a frame could never pass.
+TrafficLimits trafficLimits(double messagesPerSecond, double bytesPerSecond) {
+    TrafficLimits limits;
+    limits.messages = { messagesPerSecond, 2 * messagesPerSecond };
+    limits.bytes = { bytesPerSecond, std::max(2 * bytesPerSecond, (double)(kFrameHeaderSize + kMaxFramePayload)) };
+    return limits;
+}
+
+struct ServerOptions {
+    LogLevel logLevel = LogLevel::Info;
+    IoBackend ioBackend = IoBackend::Poll;
+    std::string messageLogDir;      // empty disables the message log
+    size_t replayCount = 20;
+    uint16_t metricsPort = 0;       // 0 disables the metrics endpoint
+    uint16_t port = 54000;
+    size_t shardCount = std::max(1u, std::thread::hardware_concurrency());
+    OutboundLimits outboundLimits;
+    Keepalive keepalive;
+    TrafficLimits clientLimits = trafficLimits(100, 1024 * 1024);
+    TrafficLimits addressLimits;    // unlimited
+    size_t maxConnectionsPerAddress = 0;    // 0 is unlimited
+    uint8_t nodeId = 0;
+    bool nodeIdSet = false;
+    uint16_t relayPort = 0;         // 0 accepts no relay links
+    std::vector<std::string> peers; // host:port of the nodes to forward to
+};
+
+// Parses a non-negative decimal option value.
+bool parseCount(std::string_view value, unsigned long max, unsigned long& count) {
+    std::string text(value);
+    char* end = nullptr;
+    count = strtoul(text.c_str(), &end, 10);
+    return !text.empty() && *end == '\0' && text[0] != '-' && count <= max;
+}
+
+bool parseOptions(int argc, char** argv, ServerOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string_view value = argv[++i];
+        if (arg == "--log-level") {
+            if (!parseLogLevel(value, options.logLevel)) {
+                return false;
+            }
+        } else if (arg == "--io-backend") {
+            if (!parseIoBackend(value, options.ioBackend)) {
+                return false;
+            }
+        } else if (arg == "--message-log") {
+            options.messageLogDir = std::string(value);
+        } else if (arg == "--replay") {
+            unsigned long count;
+            if (!parseCount(value, 1000000, count)) {
+                return false;
+            }
+            options.replayCount = count;
+        } else if (arg == "--metrics-port") {
+            unsigned long port;
+            if (!parseCount(value, 65535, port)) {
+                return false;
+            }
+            options.metricsPort = (uint16_t)port;
+        } else if (arg == "--port") {
+            unsigned long port;
+            if (!parseCount(value, 65535, port) || port == 0) {
+                return false;
+            }
+            options.port = (uint16_t)port;
+        } else if (arg == "--shards") {
+            unsigned long count;
+            if (!parseCount(value, 1024, count) || count == 0) {
+                return false;
+            }
+            options.shardCount = count;
+        } else if (arg == "--max-queued-bytes") {
+            unsigned long bytes;
+            if (!parseCount(value, 1UL << 30, bytes) || bytes == 0) {
+                return false;
+            }
+            options.outboundLimits.maxBytes = bytes;
+        } else if (arg == "--max-queued-frames") {
+            unsigned long count;
+            if (!parseCount(value, 1000000, count) || count == 0) {
+                return false;
+            }
+            options.outboundLimits.maxFrames = count;
+        } else if (arg == "--node-id") {
+            unsigned long id;
+            if (!parseCount(value, 255, id)) {
+                return false;
+            }
+            options.nodeId = (uint8_t)id;
+            options.nodeIdSet = true;
+        } else if (arg == "--relay-port") {
+            unsigned long port;
+            if (!parseCount(value, 65535, port) || port == 0) {
+                return false;
+            }
+            options.relayPort = (uint16_t)port;
+        } else if (arg == "--peer") {
+            std::string host;
+            uint16_t port;
+            if (!parsePeerAddress(value, host, port)) {
+                return false;
+            }
+            options.peers.push_back(std::string(value));
+        } else if (arg == "--client-msg-rate" || arg == "--client-byte-rate" || arg == "--ip-msg-rate" || arg == "--ip-byte-rate") {
+            unsigned long rate;
+            if (!parseCount(value, 1UL << 30, rate)) {
+                return false;
+            }
+            TrafficLimits& limits = arg.starts_with("--client") ? options.clientLimits : options.addressLimits;
+            bool messages = arg.ends_with("msg-rate");
+            limits = trafficLimits(messages ? (double)rate : limits.messages.perSecond, messages ? limits.bytes.perSecond : (double)rate);
+        } else if (arg == "--max-connections-per-ip") {
+            unsigned long count;
+            if (!parseCount(value, 1000000, count)) {
+                return false;
+            }
+            options.maxConnectionsPerAddress = count;
+        } else if (arg == "--ping-interval") {
+            unsigned long seconds;
+            if (!parseCount(value, 24 * 3600, seconds)) {
+                return false;
+            }
+            options.keepalive.pingIntervalMs = seconds * 1000;
+        } else if (arg == "--idle-timeout") {
+            unsigned long seconds;
+            if (!parseCount(value, 24 * 3600, seconds)) {
+                return false;
+            }
+            options.keepalive.idleTimeoutMs = seconds * 1000;
+        } else if (arg == "--overflow-policy") {
+            if (!parseOverflowPolicy(value, options.outboundLimits.policy)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    // Federated nodes must not share the default ID, or they would hand out
+    // the same user IDs
+    if ((!options.peers.empty() || options.relayPort != 0) && !options.nodeIdSet) {
+        return false;
+    }
+    // A client must get the chance to answer a ping before it times out
+    const Keepalive& keepalive = options.keepalive;
+    return keepalive.idleTimeoutMs == 0 || keepalive.pingIntervalMs < keepalive.idleTimeoutMs;
+}
+
+int main(int argc, char** argv) {
+    ServerOptions options;
+    bool validOptions = parseOptions(argc, argv, options);
+    startLogger(options.logLevel);
+    if (!validOptions) {
+        logError("Usage: Server [--log-level debug|info|warn|error] [--io-backend poll|uring] [--message-log DIR] [--replay N] [--metrics-port PORT] [--port PORT] [--shards N] "
+            "[--max-queued-bytes N] [--max-queued-frames N] [--overflow-policy drop-oldest|disconnect|summarize] "
+            "[--ping-interval SECONDS] [--idle-timeout SECONDS] [--client-msg-rate N] [--client-byte-rate N] [--ip-msg-rate N] [--ip-byte-rate N] [--max-connections-per-ip N] "
+            "[--node-id N] [--relay-port PORT] [--peer HOST:PORT]...");
+        stopLogger();
         return 1;
     }
 
-    std::cout << "Server is listening on port 54000..." << std::endl;
+    replayCount = options.replayCount;
+    users.setNode(options.nodeId);
+    if (!options.messageLogDir.empty()) {
+        messageLog = std::make_unique<MessageLog>(options.messageLogDir, options.replayCount, &users);
+        if (!messageLog->open()) {
+            stopLogger();
+            return 1;
+        }
+    }
 
-    // Accept multiple clients
-    while (true) {
-        sockaddr_in clientAddr;
-        int clientSize = sizeof(clientAddr);
+    Connection::setOutboundLimits(options.outboundLimits);
+    Connection::setKeepalive(options.keepalive);
+    clientLimits = options.clientLimits;
+    addressLimiter = std::make_unique<AddressLimiter>(options.maxConnectionsPerAddress, options.addressLimits);
 
-        SOCKET clientSocket = accept(serverSocket, (sockaddr*)&clientAddr, &clientSize);
-        if (clientSocket == INVALID_SOCKET) {
-            std::cerr << "Accept failed. Error: " << WSAGetLastError() << std::endl;
-            continue;
+    // Initialize Winsock
+    if (!netStartup()) {
+        logError("Failed to initialize Winsock.");
+        stopLogger();
+        return 1;
+    }
+
+    // Each shard is an event loop multiplexing its own clients, instead of
+    // one OS thread (and stack) per connection.
+    rooms = std::make_unique<RoomDirectory>(options.shardCount, std::min(replayCount, kMaxRoomHistory), messageLog.get());
+    for (size_t i = 0; i < options.shardCount; ++i) {
+        shards.push_back(std::make_unique<EventLoop>(options.ioBackend, i));
+    }
+
+    // With SO_REUSEPORT every shard accepts on its own listening socket and
+    // keeps the connections it accepts, so reconnect storms are spread over
+    // all cores. Without it the first shard accepts for everyone and hands
+    // sockets out in round-robin order.
+    size_t listenerCount = kHaveReusePort ? shards.size() : 1;
+    std::vector<SOCKET> listeners;
+    std::vector<std::unique_ptr<Acceptor>> acceptors;
+    size_t nextShard = 0;
+    for (size_t i = 0; i < listenerCount; ++i) {
+        SOCKET listener = openListener(options.port, kHaveReusePort);
+        if (listener == INVALID_SOCKET) {
+            for (SOCKET s : listeners) {
+                closesocket(s);
+            }
+            netCleanup();
+            stopLogger();
+            return 1;
+        }
+        listeners.push_back(listener);
+
+        acceptors.push_back(std::make_unique<Acceptor>(listener, [&, i](SOCKET clientSocket) {
+            if (!setNonBlocking(clientSocket)) {
+                logError("Failed to make client socket non-blocking. Error: ", lastSocketError());
+                closesocket(clientSocket);
+                return;
+            }
+
+            SourceAddress* source = addressLimiter->admit(clientSocket);
+            if (source == nullptr) {
+                countEvent(Counter::ConnectionsRefused);
+                logDebug("Refused a connection: too many from its address.");
+                closesocket(clientSocket);
+                return;
+            }
+
+            size_t target = kHaveReusePort ? i : nextShard++ % shards.size();
+            EventLoop& loop = *shards[target];
+            auto conn = std::make_shared<Connection>(clientSocket, loop);
+            // The session starts awaiting the Hello before the socket is registered
+            if (target == i) {
+                handleClient(conn, source);
+                conn->start();
+            } else {
+                loop.post([conn, source]() {
+                    handleClient(conn, source);
+                    conn->start();
+                });
+            }
+        }));
+
+        EventLoop& loop = *shards[i];
+        Acceptor* acceptor = acceptors.back().get();
+        loop.post([&loop, listener, acceptor]() {
+            if (!loop.addListener(listener, acceptor)) {
+                logError("Failed to register listening socket with event loop. Error: ", lastSocketError());
+            }
+        });
+    }
+
+    // Peer nodes connect to the relay port; their links are spread over the
+    // shards like clients and run handleRelayLink instead of handleClient.
+    size_t nextRelayShard = 0;
+    if (options.relayPort != 0) {
+        SOCKET listener = openListener(options.relayPort, false);
+        if (listener == INVALID_SOCKET) {
+            for (SOCKET s : listeners) {
+                closesocket(s);
+            }
+            netCleanup();
+            stopLogger();
+            return 1;
         }
+        listeners.push_back(listener);
+
+        acceptors.push_back(std::make_unique<Acceptor>(listener, [&](SOCKET linkSocket) {
+            if (!setNonBlocking(linkSocket)) {
+                logError("Failed to make relay socket non-blocking. Error: ", lastSocketError());
+                closesocket(linkSocket);
+                return;
+            }
+            EventLoop& loop = *shards[nextRelayShard++ % shards.size()];
+            auto conn = std::make_shared<Connection>(linkSocket, loop);
+            conn->disablePings();
+            loop.post([conn]() {
+                handleRelayLink(conn);
+                conn->start();
+            });
+        }));
+
+        EventLoop& loop = *shards[0];
+        Acceptor* acceptor = acceptors.back().get();
+        loop.post([&loop, listener, acceptor]() {
+            if (!loop.addListener(listener, acceptor)) {
+                logError("Failed to register relay socket with event loop. Error: ", lastSocketError());
+            }
+        });
+    }
+
+    // Our links keep the peers' inbound ends alive, assuming every node runs
+    // with the same keepalive settings
+    uint64_t relayHeartbeatMs = options.keepalive.pingIntervalMs != 0
+        ? options.keepalive.pingIntervalMs : options.keepalive.idleTimeoutMs / 2;
+    for (const std::string& peer : options.peers) {
+        std::string host;
+        uint16_t port;
+        parsePeerAddress(peer, host, port);
+        relayLinks.push_back(std::make_unique<RelayLink>(host, port, options.nodeId, std::chrono::milliseconds(relayHeartbeatMs)));
+        relayLinks.back()->start();
+    }
 
-        // Lock the clients vector and add the new client
-        {
-            std::lock_guard<std::mutex> guard(clients_mutex);
-            clients.push_back(clientSocket);
+    if (options.metricsPort != 0 && !startMetricsServer(options.metricsPort)) {
+        for (SOCKET s : listeners) {
+            closesocket(s);
         }
+        netCleanup();
+        stopLogger();
+        return 1;
+    }
+
+    std::vector<std::thread> shardThreads;
+    for (auto& shard : shards) {
+        EventLoop* loop = shard.get();
+        shardThreads.emplace_back([loop]() { loop->run(); });
+    }
 
-        // Create a new thread for each connected client
-        std::thread clientThread(handleClient, clientSocket);
-        clientThread.detach();  // Detach so that the main thread doesn't have to wait for it to finish
+    logInfo("Server is listening on port ", options.port, " with ", shards.size(), " ",
+        shards[0]->completionBased() ? "io_uring" : "poll", " shards and ", listenerCount, " listening sockets...");
+    if (options.relayPort != 0 || !relayLinks.empty()) {
+        logInfo("Node ", options.nodeId, " accepts relay links on port ", options.relayPort, " and forwards to ", relayLinks.size(), " peers.");
+    }
+
+    // The shards serve clients until the process is stopped
+    for (auto& t : shardThreads) {
+        t.join();
     }
 
     // Cleanup
-    closesocket(serverSocket);
-    WSACleanup();
+    for (auto& link : relayLinks) {
+        link->stop();
+    }
+    stopMetricsServer();
+    for (SOCKET s : listeners) {
+        closesocket(s);
+    }
+    netCleanup();
+    if (messageLog) {
+        messageLog->close();
+    }
+    stopLogger();
     return 0;
 }
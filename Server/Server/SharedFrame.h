@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <string_view>
+#include <utility>
+#include "BufferPool.h"
+#include "Protocol.h"
+
+// Immutable, reference-counted byte buffer. The count and the bytes live in a
+// single pooled block, so a message is encoded once and fanned out to every
+// recipient queue by bumping the count instead of copying the bytes.
+class SharedFrame {
+public:
+    SharedFrame() = default;
+
+    SharedFrame(const SharedFrame& other) : block(other.block) {
+        if (block) {
+            block->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SharedFrame(SharedFrame&& other) noexcept : block(other.block) {
+        other.block = nullptr;
+    }
+
+    SharedFrame& operator=(SharedFrame other) noexcept {
+        std::swap(block, other.block);
+        return *this;
+    }
+
+    ~SharedFrame() {
+        if (block && block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            block->~Block();
+            poolRelease(block);
+        }
+    }
+
+    // Encodes a wire frame whose payload is the concatenation of the given
+    // pieces, header included, in one allocation.
+    static SharedFrame encode(FrameType type, std::initializer_list<std::string_view> payloadParts) {
+        size_t payloadSize = 0;
+        for (std::string_view part : payloadParts) {
+            payloadSize += part.size();
+        }
+        SharedFrame frame = allocate(kFrameHeaderSize + payloadSize);
+        char* out = frame.block->data;
+        writeFrameHeader(out, type, (uint32_t)payloadSize);
+        out += kFrameHeaderSize;
+        for (std::string_view part : payloadParts) {
+            std::memcpy(out, part.data(), part.size());
+            out += part.size();
+        }
+        return frame;
+    }
+
+    // Wraps an already-encoded frame, such as one read back from disk.
+    static SharedFrame copyOf(const char* data, size_t size) {
+        SharedFrame frame = allocate(size);
+        std::memcpy(frame.block->data, data, size);
+        return frame;
+    }
+
+    const char* data() const { return block ? block->data : nullptr; }
+    std::string_view payload() const {
+        return size() >= kFrameHeaderSize ? std::string_view(data() + kFrameHeaderSize, size() - kFrameHeaderSize) : std::string_view();
+    }
+    size_t size() const { return block ? block->size : 0; }
+    bool empty() const { return size() == 0; }
+
+    // metricsNow() when the message that produced the frame was received, or
+    // 0 if untracked. Set before the frame is shared.
+    uint64_t receivedAt() const { return block ? block->receivedAt : 0; }
+    void setReceivedAt(uint64_t nanos) { block->receivedAt = nanos; }
+
+    // Sequence number of a server -> client room frame. Set before the frame
+    // is shared.
+    uint64_t sequence() const { return getUint64(data() + sequenceOffset(data())); }
+    void setSequence(uint64_t sequence) { putUint64(block->data + sequenceOffset(block->data), sequence); }
+
+private:
+    struct Block {
+        std::atomic<uint32_t> refs;
+        uint32_t size;
+        uint64_t receivedAt;
+        char data[1];
+    };
+
+    static SharedFrame allocate(size_t size) {
+        void* memory = poolAllocate(offsetof(Block, data) + size);
+        SharedFrame frame;
+        frame.block = new (memory) Block;
+        frame.block->refs.store(1, std::memory_order_relaxed);
+        frame.block->size = (uint32_t)size;
+        frame.block->receivedAt = 0;
+        return frame;
+    }
+
+    Block* block = nullptr;
+};
@@ -0,0 +1,112 @@
+#include "TimerWheel.h"
+
+#include <chrono>
+#include "EventLoop.h"
+
+void Timer::cancel() {
+    if (wheel != nullptr && armed()) {
+        wheel->unlink(*this);
+    }
+}
+
+uint64_t TimerWheel::nowMs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TimerWheel::TimerWheel(uint64_t nowMs)
+    : currentTick(nowMs / kTickMs) {
+}
+
+void TimerWheel::schedule(Timer& timer, uint64_t delayMs) {
+    timer.cancel();
+    uint64_t ticks = (delayMs + kTickMs - 1) / kTickMs;
+    timer.expiry = currentTick + (ticks == 0 ? 1 : ticks);
+    timer.wheel = this;
+    insert(timer);
+}
+
+// Files the timer in the lowest level whose span reaches its expiry.
+void TimerWheel::insert(Timer& timer) {
+    uint64_t delta = timer.expiry - currentTick;
+    size_t level = 0;
+    while (level + 1 < kLevels && delta >= ((uint64_t)1 << (kSlotBits * (level + 1)))) {
+        ++level;
+    }
+    uint64_t maxDelta = ((uint64_t)1 << (kSlotBits * (level + 1))) - 1;
+    uint64_t at = delta > maxDelta ? currentTick + maxDelta : timer.expiry;
+    Timer*& head = slots[level][(at >> (kSlotBits * level)) & (kSlots - 1)];
+
+    timer.next = head;
+    if (head != nullptr) {
+        head->pprev = &timer.next;
+    }
+    head = &timer;
+    timer.pprev = &head;
+    ++count;
+}
+
+void TimerWheel::unlink(Timer& timer) {
+    *timer.pprev = timer.next;
+    if (timer.next != nullptr) {
+        timer.next->pprev = timer.pprev;
+    }
+    timer.next = nullptr;
+    timer.pprev = nullptr;
+    --count;
+}
+
+// Re-files the timers of the level's current slot; each lands lower down.
+void TimerWheel::cascade(size_t level) {
+    Timer*& head = slots[level][(currentTick >> (kSlotBits * level)) & (kSlots - 1)];
+    Timer* timer = head;
+    head = nullptr;
+    while (timer != nullptr) {
+        Timer* next = timer->next;
+        timer->pprev = nullptr;
+        --count;
+        insert(*timer);
+        timer = next;
+    }
+}
+
+void TimerWheel::advance(uint64_t nowMs) {
+    uint64_t target = nowMs / kTickMs;
+    if (count == 0) {
+        currentTick = target > currentTick ? target : currentTick;
+        return;
+    }
+
+    while (currentTick < target) {
+        ++currentTick;
+        // Entering a new slot of a level first pulls that slot's timers down
+        for (size_t level = 1; level < kLevels; ++level) {
+            if ((currentTick & (((uint64_t)1 << (kSlotBits * level)) - 1)) != 0) {
+                break;
+            }
+            cascade(level);
+        }
+
+        // Handlers may arm or cancel timers, including ones in this slot
+        Timer*& head = slots[0][currentTick & (kSlots - 1)];
+        while (head != nullptr) {
+            Timer* timer = head;
+            unlink(*timer);
+            if (timer->expiry > currentTick) {
+                insert(*timer);     // clamped to the top level; not due yet
+                continue;
+            }
+            timer->handler->onTimer();
+        }
+        if (count == 0) {
+            currentTick = target;
+        }
+    }
+}
+
+int TimerWheel::waitMs(uint64_t nowMs) const {
+    if (count == 0) {
+        return -1;
+    }
+    return (int)(kTickMs - nowMs % kTickMs);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class IoHandler;
+
+// One pending expiry on a TimerWheel. Embedded in its owner; the wheel links
+// it in place, so arming, re-arming and cancelling never allocate.
+class Timer {
+public:
+    explicit Timer(IoHandler* handler) : handler(handler) {}
+    ~Timer() { cancel(); }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    bool armed() const { return pprev != nullptr; }
+    void cancel();
+
+private:
+    friend class TimerWheel;
+
+    IoHandler* handler;         // onTimer() is called on expiry
+    Timer* next = nullptr;
+    Timer** pprev = nullptr;    // the pointer that points at this timer, or nullptr when idle
+    uint64_t expiry = 0;        // in ticks
+    class TimerWheel* wheel = nullptr;
+};
+
+// Hierarchical timing wheel (Varghese & Lauck) for one event loop thread.
+//
+// Level 0 has a slot per tick for the next kSlots ticks, and each level above
+// covers kSlots times the span of the one below with the same number of
+// slots. Arming or cancelling a timer is O(1) whatever the number of timers;
+// a timer on an upper level is moved down one level at a time as its slot
+// comes due. Timers further out than the top level covers are clamped to it
+// and re-armed when they come due, so any delay works.
+//
+// Expiries are rounded up to whole ticks. Not thread-safe.
+class TimerWheel {
+public:
+    static const uint64_t kTickMs = 100;
+
+    // Monotonic clock in milliseconds, the wheel's time base.
+    static uint64_t nowMs();
+
+    explicit TimerWheel(uint64_t nowMs = TimerWheel::nowMs());
+
+    // (Re)arms the timer to fire delayMs from now (at least one tick).
+    void schedule(Timer& timer, uint64_t delayMs);
+
+    // Fires every timer due by nowMs, in tick order.
+    void advance(uint64_t nowMs);
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // How long the loop may block before advance() has work: -1 when no
+    // timer is armed, otherwise the time left in the current tick.
+    int waitMs(uint64_t nowMs) const;
+
+private:
+    friend class Timer;
+
+    static const size_t kLevels = 4;
+    static const unsigned kSlotBits = 6;
+    static const size_t kSlots = (size_t)1 << kSlotBits;
+
+    void insert(Timer& timer);
+    void unlink(Timer& timer);
+    void cascade(size_t level);
+
+    Timer* slots[kLevels][kSlots] = {};
+    uint64_t currentTick;
+    size_t count = 0;
+};
@@ -0,0 +1,124 @@
+#include "Users.h"
+
+#include <filesystem>
+#include <vector>
+#include "Logger.h"
+#include "Protocol.h"
+
+UserTable::~UserTable() {
+    if (file != nullptr) {
+        fclose(file);
+    }
+}
+
+// Runs before the server starts, so the table needs no locking yet.
+bool UserTable::open(const std::string& path) {
+    if (FILE* existing = fopen(path.c_str(), "rb")) {
+        std::vector<char> contents;
+        char chunk[4096];
+        size_t read;
+        while ((read = fread(chunk, 1, sizeof(chunk), existing)) > 0) {
+            contents.insert(contents.end(), chunk, chunk + read);
+        }
+        fclose(existing);
+
+        // Stop at a torn entry left by a crash mid-append and cut it off
+        size_t validSize = 0;
+        std::string_view rest(contents.data(), contents.size());
+        while (rest.size() >= kUserIdSize + 1 && rest.size() >= kUserIdSize + 1 + (unsigned char)rest[kUserIdSize]) {
+            size_t entrySize = kUserIdSize + 1 + (unsigned char)rest[kUserIdSize];
+            parseUserEntries(rest.substr(0, entrySize), [this](uint32_t id, std::string_view name) {
+                add(id, name);
+            });
+            rest.remove_prefix(entrySize);
+            validSize += entrySize;
+        }
+        if (validSize != contents.size()) {
+            std::error_code error;
+            std::filesystem::resize_file(path, validSize, error);
+        }
+    }
+
+    file = fopen(path.c_str(), "ab");
+    if (file == nullptr) {
+        logError("Cannot open user table '", path, "' for writing.");
+        return false;
+    }
+    logInfo("User table '", path, "' opened with ", names.size(), " users.");
+    return true;
+}
+
+uint32_t UserTable::intern(std::string_view name) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = localIds.find(std::string(name));
+    if (it != localIds.end()) {
+        return it->second;
+    }
+    if (nextLocalId >= (1u << kLocalIdBits) || names.size() >= kMaxNames) {
+        return kNoUser;
+    }
+    uint32_t id = ((uint32_t)nodeId << kLocalIdBits) | nextLocalId;
+    add(id, name);
+    queueEntry(id, name);
+    return id;
+}
+
+void UserTable::remember(uint32_t id, std::string_view name) {
+    if ((id >> kLocalIdBits) == nodeId) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = names.find(id);
+    if (it != names.end() ? it->second == name : names.size() >= kMaxNames) {
+        return;
+    }
+    add(id, name);
+    queueEntry(id, name);
+}
+
+bool UserTable::lookup(uint32_t id, std::string& name) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = names.find(id);
+    if (it == names.end()) {
+        return false;
+    }
+    name = it->second;
+    return true;
+}
+
+// Caller holds the lock (or is still in open()).
+void UserTable::add(uint32_t id, std::string_view name) {
+    names[id] = std::string(name);
+    if ((id >> kLocalIdBits) == nodeId) {
+        localIds[std::string(name)] = id;
+        uint32_t local = id & ((1u << kLocalIdBits) - 1);
+        if (local >= nextLocalId) {
+            nextLocalId = local + 1;
+        }
+    }
+}
+
+// Caller holds the lock.
+void UserTable::queueEntry(uint32_t id, std::string_view name) {
+    if (file != nullptr) {
+        appendUserEntry(pendingEntries, id, name);
+    }
+}
+
+// The writer calls this before writing each batch of frames, and an entry is
+// queued before any frame carries its ID, so a process crash never leaves
+// logged messages from an unknown sender. Not synced: after a power loss
+// such a sender merely fails to resolve.
+void UserTable::writePending() {
+    std::string entries;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        entries.swap(pendingEntries);
+    }
+    if (entries.empty()) {
+        return;
+    }
+    if (fwrite(entries.data(), 1, entries.size(), file) != entries.size() || fflush(file) != 0) {
+        logError("Failed to append to the user table.");
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Interns user names as compact numeric IDs, so chat frames carry four bytes
+// instead of the sender's name. The same name always gets the same ID and
+// IDs are never reused.
+//
+// The top byte of an ID is the node that assigned it and the rest counts up
+// from 1, so federated nodes never hand out the same ID. Names of users on
+// other nodes are learned from relay links with remember().
+//
+// The table is bounded: once the node has handed out every local ID, or the
+// table holds kMaxNames names, new names are refused rather than growing it
+// further. Known names keep their IDs.
+//
+// With a backing file (opened by the message log) the table survives
+// restarts, so replayed frames still resolve. The file holds entries in the
+// Users wire format: uint32 ID + uint8 name length + name. New entries are
+// only queued here; the message log's writer thread writes them out.
+class UserTable {
+public:
+    static const uint32_t kLocalIdBits = 24;
+    static const size_t kMaxNames = 1u << kLocalIdBits;
+
+    // Never assigned to a name.
+    static const uint32_t kNoUser = 0;
+
+    UserTable() = default;
+    ~UserTable();
+
+    UserTable(const UserTable&) = delete;
+    UserTable& operator=(const UserTable&) = delete;
+
+    // Node whose IDs intern() assigns. Set before open().
+    void setNode(uint8_t node) { nodeId = node; }
+    uint8_t node() const { return nodeId; }
+
+    // Loads the names already in the file and appends new ones to it.
+    bool open(const std::string& path);
+
+    // Returns the name's ID, assigning the next one on first sight, or
+    // kNoUser if a new name does not fit. Thread-safe.
+    uint32_t intern(std::string_view name);
+
+    // Records the name another node assigned an ID to. IDs in this node's
+    // range are ignored: only intern() hands those out, and so are new IDs
+    // once the table is full. Thread-safe.
+    void remember(uint32_t id, std::string_view name);
+
+    // Writes the entries queued since the last call. Message log writer
+    // thread only.
+    void writePending();
+
+    // False if no name has that ID. Thread-safe.
+    bool lookup(uint32_t id, std::string& name) const;
+
+private:
+    void add(uint32_t id, std::string_view name);
+    void queueEntry(uint32_t id, std::string_view name);
+
+    uint8_t nodeId = 0;
+    mutable std::mutex mutex;
+    std::unordered_map<uint32_t, std::string> names;
+    std::unordered_map<std::string, uint32_t> localIds;    // names this node assigned
+    uint32_t nextLocalId = 1;
+    std::string pendingEntries;     // guarded by mutex; written by writePending()
+    FILE* file = nullptr;
+};